@@ -0,0 +1,286 @@
+#include "../include/config.h"
+#include <chrono>
+#include <fstream>
+#include <thread>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+using namespace std;
+
+/*
+    配置性能测试：先测嵌套容器从yaml加载和导出的耗时，以及启动时从yaml和从二进制快照加载的对比；
+    再测多个线程反复读同一个配置项，另一个线程每毫秒用fromString重新加载一次，
+    输出各种读法的总吞吐，以及写线程完成的加载次数。
+    用法: bench_config [最大线程数] [用例名过滤]
+    快照用例在当前目录下生成bench_config.yml和bench_config.snap，结束时删除
+*/
+static const char *s_filter = nullptr;
+
+static vector<int> MakeVec(int n, int base)
+{
+    vector<int> v(n);
+    for (int i = 0; i < n; ++i)
+    {
+        v[i] = base + i;
+    }
+    return v;
+}
+
+// read(const ConfigVar&, int i)返回读到的某个值，累加起来避免被优化掉
+template <class Var, class F>
+static void Bench(const char *name, typename Var::ptr var, const string &a, const string &b, int max_threads, F read)
+{
+    if (s_filter && !strstr(name, s_filter))
+    {
+        return;
+    }
+    printf("\n== %s ==\n", name);
+    const auto duration = chrono::milliseconds(300);
+    for (int threads = 1; threads <= max_threads; threads *= 2)
+    {
+        atomic<bool> stop{false};
+        atomic<uint64_t> reloads{0};
+        thread writer([&]()
+                      {
+                          for (uint64_t i = 0; !stop.load(); ++i)
+                          {
+                              var->fromString(i % 2 ? a : b);
+                              reloads.fetch_add(1, memory_order_relaxed);
+                              this_thread::sleep_for(chrono::milliseconds(1));
+                          } });
+        vector<uint64_t> counts(threads);
+        vector<uint64_t> sums(threads);
+        vector<thread> readers;
+        for (int t = 0; t < threads; ++t)
+        {
+            readers.emplace_back([&, t]()
+                                 {
+                                     uint64_t n = 0, sum = 0;
+                                     auto end = chrono::steady_clock::now() + duration;
+                                     while (chrono::steady_clock::now() < end)
+                                     {
+                                         for (int i = 0; i < 256; ++i)
+                                         {
+                                             sum += read(*var, i);
+                                         }
+                                         n += 256;
+                                     }
+                                     counts[t] = n;
+                                     sums[t] = sum; });
+        }
+        uint64_t total = 0, sum = 0;
+        for (int t = 0; t < threads; ++t)
+        {
+            readers[t].join();
+            total += counts[t];
+            sum += sums[t];
+        }
+        stop = true;
+        writer.join();
+        double secs = chrono::duration<double>(duration).count();
+        printf("%2d threads %10.2f Mreads/s %6llu reloads  (sum %llu)\n", threads, total / secs / 1e6,
+               (unsigned long long)reloads.load(), (unsigned long long)(sum & 0xff));
+    }
+}
+
+// map<string, vector<int>>，100个key每个100个数
+static void BenchLoad()
+{
+    if (s_filter && !strstr("load", s_filter))
+    {
+        return;
+    }
+    printf("\n== load, map<string, vector<int>> 100x100 ==\n");
+    typedef jyl::ConfigVar<map<string, vector<int>>> MapVar;
+    MapVar::ptr var = jyl::Config::Lookup("bench.load", map<string, vector<int>>(), "bench nested map");
+    YAML::Node root;
+    for (int i = 0; i < 100; ++i)
+    {
+        for (int j = 0; j < 100; ++j)
+        {
+            root["bench"]["load"]["k" + to_string(i)].push_back(i * 100 + j);
+        }
+    }
+    YAML::Node other = YAML::Clone(root);
+    other["bench"]["load"]["k0"][0] = -1;
+    const int n = 20;
+    auto begin = chrono::steady_clock::now();
+    for (int i = 0; i < n; ++i)
+    {
+        // 交替加载，保证每次都真的改了值
+        jyl::Config::LoadFromYaml(i % 2 ? other : root);
+    }
+    auto end = chrono::steady_clock::now();
+    printf("%-40s %10.1f us\n", "LoadFromYaml", chrono::duration<double, micro>(end - begin).count() / n);
+    begin = chrono::steady_clock::now();
+    size_t len = 0;
+    for (int i = 0; i < n; ++i)
+    {
+        len += var->toString().size();
+    }
+    end = chrono::steady_clock::now();
+    printf("%-40s %10.1f us\n", "toString", chrono::duration<double, micro>(end - begin).count() / n);
+    jyl::Config::LoadFromYaml(root);
+    string str[2] = {var->toString()};
+    jyl::Config::LoadFromYaml(other);
+    str[1] = var->toString();
+    begin = chrono::steady_clock::now();
+    for (int i = 0; i < n; ++i)
+    {
+        var->fromString(str[i % 2]);
+    }
+    end = chrono::steady_clock::now();
+    printf("%-40s %10.1f us  (%zu bytes)\n", "fromString", chrono::duration<double, micro>(end - begin).count() / n,
+           len / n);
+}
+
+// 文档里有20000个key，只有一个分支下有注册的配置项
+static void BenchSparseLoad()
+{
+    if (s_filter && !strstr("sparse", s_filter))
+    {
+        return;
+    }
+    printf("\n== sparse load, 200x100 keys, 10 registered ==\n");
+    vector<jyl::ConfigVar<int>::ptr> vars;
+    for (int i = 0; i < 10; ++i)
+    {
+        vars.push_back(jyl::Config::Lookup("sparse.m0.k" + to_string(i), 0, "bench sparse"));
+    }
+    YAML::Node root;
+    for (int i = 0; i < 200; ++i)
+    {
+        for (int j = 0; j < 100; ++j)
+        {
+            root["sparse"]["m" + to_string(i)]["k" + to_string(j)] = j;
+        }
+    }
+    const int n = 20;
+    auto begin = chrono::steady_clock::now();
+    for (int i = 0; i < n; ++i)
+    {
+        jyl::Config::LoadFromYaml(root);
+    }
+    auto end = chrono::steady_clock::now();
+    printf("%-40s %10.1f us\n", "LoadFromYaml", chrono::duration<double, micro>(end - begin).count() / n);
+}
+
+// 1000组配置，每组int、string、vector<int>、map<string, int>各一个
+static void BenchSnapshot()
+{
+    if (s_filter && !strstr("cold start", s_filter))
+    {
+        return;
+    }
+    printf("\n== cold start, 4000 config vars ==\n");
+    vector<jyl::ConfigVarBase::ptr> vars;
+    YAML::Node root;
+    for (int i = 0; i < 1000; ++i)
+    {
+        string prefix = "snap.s" + to_string(i) + ".";
+        vars.push_back(jyl::Config::Lookup(prefix + "port", 0, "bench snapshot"));
+        vars.push_back(jyl::Config::Lookup(prefix + "name", string(), "bench snapshot"));
+        vars.push_back(jyl::Config::Lookup(prefix + "list", vector<int>(), "bench snapshot"));
+        vars.push_back(jyl::Config::Lookup(prefix + "map", map<string, int>(), "bench snapshot"));
+        YAML::Node s = root["snap"]["s" + to_string(i)];
+        s["port"] = 8000 + i;
+        s["name"] = "server-" + to_string(i);
+        for (int j = 0; j < 10; ++j)
+        {
+            s["list"].push_back(i + j);
+            s["map"]["k" + to_string(j)] = j;
+        }
+    }
+    // 每次加载前回到默认值，模拟刚启动
+    vector<string> defaults;
+    for (auto &i : vars)
+    {
+        defaults.push_back(i->toString());
+    }
+    auto reset = [&]()
+    {
+        for (size_t i = 0; i < vars.size(); ++i)
+        {
+            vars[i]->fromString(defaults[i]);
+        }
+    };
+    const char *yml = "bench_config.yml";
+    const char *snap = "bench_config.snap";
+    {
+        ofstream ofs(yml);
+        ofs << root;
+    }
+    jyl::Config::LoadFromYaml(YAML::LoadFile(yml));
+    jyl::Config::SaveSnapshot(snap, {yml});
+    string expect = vars.back()->toString();
+
+    const int n = 10;
+    double yaml_us = 0, snap_us = 0;
+    for (int i = 0; i < n; ++i)
+    {
+        reset();
+        auto begin = chrono::steady_clock::now();
+        jyl::Config::LoadFromYaml(YAML::LoadFile(yml));
+        auto end = chrono::steady_clock::now();
+        yaml_us += chrono::duration<double, micro>(end - begin).count();
+
+        reset();
+        begin = chrono::steady_clock::now();
+        bool ok = jyl::Config::LoadSnapshot(snap, {yml});
+        end = chrono::steady_clock::now();
+        snap_us += chrono::duration<double, micro>(end - begin).count();
+        if (!ok || vars.back()->toString() != expect)
+        {
+            printf("snapshot load failed\n");
+            break;
+        }
+    }
+    printf("%-40s %10.1f us\n", "LoadFromYaml(LoadFile)", yaml_us / n);
+    printf("%-40s %10.1f us\n", "LoadSnapshot", snap_us / n);
+    unlink(yml);
+    unlink(snap);
+}
+
+int main(int argc, char **argv)
+{
+    int max_threads = argc > 1 ? atoi(argv[1]) : 0;
+    if (max_threads <= 0)
+    {
+        max_threads = max(1u, thread::hardware_concurrency());
+    }
+    s_filter = argc > 2 ? argv[2] : nullptr;
+    // 加载时打印的日志不关心
+    JYL_LOG_ROOT()->setLevel(jyl::LogLevel::ERROR);
+    BenchLoad();
+    BenchSparseLoad();
+    BenchSnapshot();
+
+    typedef jyl::ConfigVar<vector<int>> VecVar;
+    VecVar::ptr vec = jyl::Config::Lookup("bench.vec", MakeVec(1000, 0), "bench vector");
+    string vec_a = vec->toString();
+    vec->setValue(MakeVec(1000, 1));
+    string vec_b = vec->toString();
+
+    typedef jyl::ConfigVar<int> IntVar;
+    IntVar::ptr port = jyl::Config::Lookup("bench.port", 8080, "bench int");
+
+    Bench<VecVar>("vector<int>[1000] getValue (copy)", vec, vec_a, vec_b, max_threads,
+                  [](const VecVar &v, int i)
+                  { return (uint64_t)v.getValue()[i]; });
+    Bench<VecVar>("vector<int>[1000] getRef", vec, vec_a, vec_b, max_threads,
+                  [](const VecVar &v, int i)
+                  { return (uint64_t)(*v.getRef())[i]; });
+    Bench<VecVar>("vector<int>[1000] snapshot", vec, vec_a, vec_b, max_threads,
+                  [](const VecVar &v, int i)
+                  { return (uint64_t)(*v.snapshot())[i]; });
+    Bench<IntVar>("int getValue", port, "8080", "8081", max_threads,
+                  [](const IntVar &v, int)
+                  { return (uint64_t)v.getValue(); });
+    Bench<IntVar>("int getRef", port, "8080", "8081", max_threads,
+                  [](const IntVar &v, int)
+                  { return (uint64_t)*v.getRef(); });
+    return 0;
+}
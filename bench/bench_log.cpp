@@ -0,0 +1,375 @@
+#include "../include/log.h"
+#include "../include/binlog.h"
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include <new>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+using namespace std;
+
+// 统计堆分配次数，替换全局的operator new
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+static atomic<uint64_t> s_allocs{0};
+
+void *operator new(size_t n)
+{
+    s_allocs.fetch_add(1, memory_order_relaxed);
+    void *p = malloc(n);
+    if (!p)
+    {
+        throw bad_alloc();
+    }
+    return p;
+}
+void operator delete(void *p) noexcept { free(p); }
+void operator delete(void *p, size_t) noexcept { free(p); }
+
+/*
+    日志性能测试，每个用例输出平均每条的耗时和堆分配次数，多线程用例输出吞吐和单次调用的延迟分位数。
+    用法: bench_log [最大线程数] [用例名或分组名过滤]
+    文件类的输出在当前目录下生成bench_*.log，结束时删除
+*/
+static const char *s_filter = nullptr;
+static FILE *s_out = stdout; // 结果输出，测StdoutLogAppender时标准输出被重定向
+
+static const char *s_section = "";
+
+static void Section(const char *name)
+{
+    s_section = name;
+    fprintf(s_out, "\n== %s ==\n", name);
+}
+
+// 每个用例跑n次，输出平均每次的耗时和堆分配次数
+template <class F>
+static void Bench(const char *name, int n, F f)
+{
+    if (s_filter && !strstr(name, s_filter) && !strstr(s_section, s_filter))
+    {
+        return;
+    }
+    for (int i = 0; i < n / 10; ++i)
+    {
+        f();
+    }
+    uint64_t allocs = s_allocs.load();
+    auto begin = chrono::steady_clock::now();
+    for (int i = 0; i < n; ++i)
+    {
+        f();
+    }
+    auto end = chrono::steady_clock::now();
+    double ns = chrono::duration_cast<chrono::nanoseconds>(end - begin).count();
+    fprintf(s_out, "%-40s %10.1f ns/event %8.2f allocs/event\n", name, ns / n, (double)(s_allocs.load() - allocs) / n);
+}
+
+// 只格式化不输出
+class NullLogAppender : public jyl::LogAppender
+{
+public:
+    void log(jyl::Logger::ptr logger, jyl::LogLevel::Level level, jyl::LogEvent::ptr event) override
+    {
+        formatEvent(logger.get(), level, *event);
+    }
+};
+
+// 测试期间把标准输出重定向到/dev/null
+class StdoutToNull
+{
+public:
+    StdoutToNull()
+    {
+        fflush(stdout);
+        cout.flush();
+        m_saved = dup(STDOUT_FILENO);
+        int fd = open("/dev/null", O_WRONLY);
+        dup2(fd, STDOUT_FILENO);
+        close(fd);
+    }
+    ~StdoutToNull()
+    {
+        fflush(stdout);
+        cout.flush();
+        dup2(m_saved, STDOUT_FILENO);
+        close(m_saved);
+    }
+
+private:
+    int m_saved;
+};
+
+static void BenchClocks()
+{
+    Section("clocks");
+    uint64_t sum = 0;
+    Bench("getRealTimeUS", 1000000, [&]()
+          { sum += jyl::getRealTimeUS(); });
+    Bench("getCurrentMS (coarse)", 1000000, [&]()
+          { sum += jyl::getCurrentMS(); });
+    Bench("getCurrentUS", 1000000, [&]()
+          { sum += jyl::getCurrentUS(); });
+    Bench("getElapsedMS", 1000000, [&]()
+          { sum += jyl::getElapsedMS(); });
+    Bench(jyl::CycleClock::IsTSC() ? "CycleClock::Now (rdtsc)" : "CycleClock::Now", 1000000, [&]()
+          { sum += jyl::CycleClock::Now(); });
+    if (sum == 0)
+    {
+        fprintf(s_out, "\n");
+    }
+}
+
+// 被级别过滤掉的日志，编译期去掉的(JYL_LOG_ACTIVE_LEVEL)不产生任何代码，不用测
+static void BenchDisabled()
+{
+    Section("disabled level");
+    jyl::Logger::ptr logger(new jyl::Logger("bench"));
+    logger->addAppender(jyl::LogAppender::ptr(new NullLogAppender));
+    logger->setLevel(jyl::LogLevel::WARN);
+    int i = 0;
+    Bench("JYL_LOG_DEBUG << (level WARN)", 10000000, [&]()
+          { JYL_LOG_DEBUG(logger) << "hello world " << ++i << ' ' << 3.5; });
+    Bench("JYL_LOG_FMT_DEBUG (level WARN)", 10000000, [&]()
+          { JYL_LOG_FMT_DEBUG(logger, "hello world {} {}", ++i, 3.5); });
+    Bench("JYL_LOG_EVERY_N DEBUG (level WARN)", 10000000, [&]()
+          { JYL_LOG_EVERY_N(logger, jyl::LogLevel::DEBUG, 100) << "hello world " << ++i; });
+}
+
+static void BenchFormatter()
+{
+    Section("formatter");
+    jyl::Logger::ptr logger(new jyl::Logger("bench"));
+    jyl::LogEvent::ptr event(new jyl::LogEvent(logger, jyl::LogLevel::INFO, __FILE__, __LINE__, 0,
+                                               jyl::getThreadID(), jyl::getFiberID(), jyl::getRealTimeUS()));
+    event->getSS() << "hello world " << 12345;
+    event->getSS().kv("user", 42).kv("cost_ms", 3.5).kv("path", "/index.html");
+
+    string out;
+    auto run = [&](const char *name, jyl::LogFormatter::ptr fmt)
+    {
+        Bench(name, 1000000, [&]()
+              {
+                  out.clear();
+                  fmt->format(out, logger.get(), jyl::LogLevel::INFO, *event); });
+    };
+    run("default pattern", jyl::LogFormatter::ptr(new jyl::LogFormatter("%d{%Y-%m-%d %H:%M:%S}%T%t%T%F%T[%p]%T%f:%l%T%m%n")));
+    run("%d{%H:%M:%S}.%ms%T%m%n", jyl::LogFormatter::ptr(new jyl::LogFormatter("%d{%H:%M:%S}.%ms%T%m%n")));
+    run("JsonLogFormatter 3 fields", jyl::LogFormatter::ptr(new jyl::JsonLogFormatter));
+    jyl::LogFormatter::ptr old_fmt(new jyl::LogFormatter("%d{%Y-%m-%d %H:%M:%S}%T%t%T%F%T[%p]%T%f:%l%T%m%n"));
+    Bench("default pattern, returning string", 1000000, [&]()
+          { out = old_fmt->format(logger, jyl::LogLevel::INFO, event); });
+
+    Section("formatter items");
+    static const char *items[] = {"%m", "%p", "%r", "%c", "%t", "%N", "%F", "%d", "%d{%Y-%m-%d %H:%M:%S}",
+                                  "%f", "%l", "%ms", "%us", "%k", "%T", "%n", "literal"};
+    for (auto item : items)
+    {
+        run(item, jyl::LogFormatter::ptr(new jyl::LogFormatter(item)));
+    }
+}
+
+static void BenchMacro()
+{
+    Section("macros, null appender");
+    jyl::Logger::ptr logger(new jyl::Logger("bench"));
+    logger->addAppender(jyl::LogAppender::ptr(new NullLogAppender));
+    int i = 0;
+    Bench("JYL_LOG_INFO <<", 1000000, [&]()
+          { JYL_LOG_INFO(logger) << "hello world " << ++i << ' ' << 3.5; });
+    Bench("JYL_LOG_FMT_INFO", 1000000, [&]()
+          { JYL_LOG_FMT_INFO(logger, "hello world {} {}", ++i, 3.5); });
+    Bench("JYL_LOG_INFO << with 2 kv", 1000000, [&]()
+          { JYL_LOG_INFO(logger).kv("i", ++i).kv("d", 3.5) << "hello world"; });
+    Bench("JYL_LOG_EVERY_N(1000)", 1000000, [&]()
+          { JYL_LOG_EVERY_N(logger, jyl::LogLevel::INFO, 1000) << "hello world " << ++i; });
+    Bench("JYL_LOG_BIN_INFO", 1000000, [&]()
+          { JYL_LOG_BIN_INFO(logger, "hello world {} {}", ++i, 3.5); });
+}
+
+static void BenchAppenders()
+{
+    Section("appenders, JYL_LOG_FMT_INFO");
+    unlink("bench_text.log");
+    unlink("bench_bin.log");
+    unlink("bench_mmap.log");
+    int i = 0;
+    auto run = [&](const char *name, jyl::LogAppender::ptr appender)
+    {
+        jyl::Logger::ptr logger(new jyl::Logger("bench"));
+        logger->addAppender(appender);
+        Bench(name, 1000000, [&]()
+              { JYL_LOG_FMT_INFO(logger, "hello world {} {} {}", ++i, 3.5, "abc"); });
+        appender->flush();
+    };
+    run("null", jyl::LogAppender::ptr(new NullLogAppender));
+    {
+        StdoutToNull redirect;
+        run("stdout (/dev/null)", jyl::LogAppender::ptr(new jyl::StdoutLogAppender));
+    }
+    run("file", jyl::LogAppender::ptr(new jyl::FileLogAppender("bench_text.log")));
+    {
+        // 和conf/log.yml里root一样：file加stdout共用logger的格式器，每条只格式化一次
+        StdoutToNull redirect;
+        jyl::Logger::ptr logger(new jyl::Logger("bench"));
+        logger->addAppender(jyl::LogAppender::ptr(new jyl::FileLogAppender("bench_text.log")));
+        jyl::LogAppender::ptr stdout_appender(new jyl::StdoutLogAppender);
+        logger->addAppender(stdout_appender);
+        Bench("file + stdout, shared formatter", 1000000, [&]()
+              { JYL_LOG_FMT_INFO(logger, "hello world {} {} {}", ++i, 3.5, "abc"); });
+        // 事件池里的事件还引用着logger，恢复标准输出前要写完
+        stdout_appender->flush();
+    }
+    run("mmap file", jyl::LogAppender::ptr(new jyl::MmapFileLogAppender("bench_mmap.log")));
+    jyl::AsyncLogAppender::ptr async(new jyl::AsyncLogAppender);
+    async->addAppender(jyl::LogAppender::ptr(new NullLogAppender));
+    run("async -> null", async);
+    async->stop();
+    run("ring buffer, no trigger", jyl::LogAppender::ptr(new jyl::RingBufferLogAppender(jyl::LogAppender::ptr(new NullLogAppender))));
+
+    jyl::Logger::ptr bin(new jyl::Logger("bin"));
+    bin->addAppender(jyl::LogAppender::ptr(new jyl::BinaryLogAppender("bench_bin.log")));
+    Bench("binary file, JYL_LOG_BIN_INFO", 1000000, [&]()
+          { JYL_LOG_BIN_INFO(bin, "hello world {} {} {}", ++i, 3.5, "abc"); });
+    // 文本appender要还原参数，两个共用一次还原
+    jyl::Logger::ptr decoded(new jyl::Logger("bin"));
+    decoded->addAppender(jyl::LogAppender::ptr(new NullLogAppender));
+    decoded->addAppender(jyl::LogAppender::ptr(new NullLogAppender));
+    Bench("null x2, JYL_LOG_BIN_INFO", 1000000, [&]()
+          { JYL_LOG_BIN_INFO(decoded, "hello world {} {} {}", ++i, 3.5, "abc"); });
+    unlink("bench_text.log");
+    unlink("bench_bin.log");
+    unlink("bench_mmap.log");
+}
+
+// 小缓存加fdatasync，每16KB落一次盘：FileLogAppender在写日志的线程里同步write+fsync，
+// UringFileLogAppender把写和fsync链接在一起提交，只有缓存都在等待时才阻塞
+static void BenchFsync()
+{
+    Section("file sinks, 16KB buffers + fdatasync");
+    unlink("bench_fsync.log");
+    int i = 0;
+    auto run = [&](const char *name, jyl::LogAppender::ptr appender)
+    {
+        jyl::Logger::ptr logger(new jyl::Logger("bench"));
+        logger->addAppender(appender);
+        Bench(name, 200000, [&]()
+              { JYL_LOG_FMT_INFO(logger, "hello world {} {} {}", ++i, 3.5, "abc"); });
+        unlink("bench_fsync.log");
+    };
+    for (bool fsync : {false, true})
+    {
+        jyl::FileLogAppender::ptr file(new jyl::FileLogAppender("bench_fsync.log", 16 * 1024));
+        file->setFsync(fsync);
+        run(fsync ? "FileLogAppender, fsync" : "FileLogAppender", file);
+        file->flush();
+
+        jyl::UringFileLogAppender::ptr uring(new jyl::UringFileLogAppender("bench_fsync.log", 16 * 1024, 4));
+        uring->setFsync(fsync);
+        run(fsync ? (uring->isUring() ? "UringFileLogAppender, fsync" : "UringFileLogAppender (write), fsync")
+                  : (uring->isUring() ? "UringFileLogAppender" : "UringFileLogAppender (write)"),
+            uring);
+        uring->sync();
+    }
+    unlink("bench_fsync.log");
+}
+
+// 1到N个线程同时调用f(i)往同一个logger写，churn时另一个线程不停地增删appender。
+// 每次调用单独计时，输出总吞吐和延迟的p50/p99/p999
+template <class F>
+static void BenchThreads(const char *name, int max_threads, jyl::Logger::ptr logger, bool churn, F f)
+{
+    if (s_filter && !strstr(name, s_filter))
+    {
+        return;
+    }
+    Section(name);
+    const int n = 200000;
+    for (int threads = 1; threads <= max_threads; threads *= 2)
+    {
+        atomic<bool> stop{false};
+        thread writer([&]()
+                      {
+                          jyl::LogAppender::ptr appender(new NullLogAppender);
+                          while (churn && !stop.load())
+                          {
+                              logger->addAppender(appender);
+                              logger->delAppender(appender);
+                              this_thread::sleep_for(chrono::milliseconds(1));
+                          } });
+        vector<vector<uint32_t>> latency(threads, vector<uint32_t>(n));
+        vector<thread> workers;
+        auto begin = chrono::steady_clock::now();
+        for (int t = 0; t < threads; ++t)
+        {
+            workers.emplace_back([&, t]()
+                                 {
+                                     vector<uint32_t> &lat = latency[t];
+                                     for (int i = 0; i < n; ++i)
+                                     {
+                                         auto b = chrono::steady_clock::now();
+                                         f(i);
+                                         auto e = chrono::steady_clock::now();
+                                         lat[i] = chrono::duration_cast<chrono::nanoseconds>(e - b).count();
+                                     } });
+        }
+        for (auto &i : workers)
+        {
+            i.join();
+        }
+        auto end = chrono::steady_clock::now();
+        stop = true;
+        writer.join();
+
+        vector<uint32_t> all;
+        all.reserve((size_t)n * threads);
+        for (auto &i : latency)
+        {
+            all.insert(all.end(), i.begin(), i.end());
+        }
+        auto percentile = [&all](double p)
+        {
+            auto it = all.begin() + (size_t)(p * (all.size() - 1));
+            nth_element(all.begin(), it, all.end());
+            return *it;
+        };
+        double ns = chrono::duration_cast<chrono::nanoseconds>(end - begin).count();
+        fprintf(s_out, "%2d threads %8.2f Mevents/s   p50 %6u ns  p99 %6u ns  p999 %7u ns\n", threads,
+               (double)n * threads / ns * 1000, percentile(0.5), percentile(0.99), percentile(0.999));
+    }
+}
+
+int main(int argc, char **argv)
+{
+    int max_threads = argc > 1 ? atoi(argv[1]) : 0;
+    if (max_threads <= 0)
+    {
+        max_threads = max(1u, thread::hardware_concurrency());
+    }
+    s_filter = argc > 2 ? argv[2] : nullptr;
+    s_out = fdopen(dup(STDOUT_FILENO), "w");
+    setvbuf(s_out, nullptr, _IOLBF, 0);
+    BenchClocks();
+    BenchDisabled();
+    BenchFormatter();
+    BenchMacro();
+    BenchAppenders();
+    BenchFsync();
+    jyl::Logger::ptr logger(new jyl::Logger("threads"));
+    logger->addAppender(jyl::LogAppender::ptr(new NullLogAppender));
+    BenchThreads("threads, JYL_LOG_FMT_INFO null appender", max_threads, logger, true, [&](int i)
+                 { JYL_LOG_FMT_INFO(logger, "hello world {} {}", i, 3.5); });
+    // 各线程编码到自己的缓存，攒够一段才进文件锁
+    unlink("bench_bin.log");
+    jyl::Logger::ptr bin(new jyl::Logger("threads"));
+    bin->addAppender(jyl::LogAppender::ptr(new jyl::BinaryLogAppender("bench_bin.log")));
+    BenchThreads("threads, JYL_LOG_BIN_INFO binary file", max_threads, bin, false, [&](int i)
+                 { JYL_LOG_BIN_INFO(bin, "hello world {} {}", i, 3.5); });
+    bin->clearAppenders();
+    unlink("bench_bin.log");
+    return 0;
+}
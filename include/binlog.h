@@ -0,0 +1,258 @@
+#pragma once
+
+#include <string>
+#include <stdint.h>
+#include <string.h>
+#include <type_traits>
+#include "../include/log.h"
+
+/*
+    二进制日志：调用点的格式串、文件、行号只在文件里记录一次，
+    每条日志只写调用点id、时间戳和参数的原始字节，由jyl-logdecode离线还原成文本。
+    格式串用{}，和JYL_LOG_FMT_*一样在编译期检查，参数只支持整数、浮点、bool、char和字符串
+*/
+#define JYL_LOG_BIN_LEVEL(logger, level, fmt, ...)                                                          \
+    do                                                                                                      \
+    {                                                                                                       \
+        static_assert(jyl::detail::CountPlaceholders(fmt) ==                                                \
+                          decltype(jyl::detail::MakeArgCount(__VA_ARGS__))::value,                          \
+                      "placeholders and arguments do not match: " fmt);                                    \
+        if (level >= JYL_LOG_ACTIVE_LEVEL && logger->getLevel() <= level)                                   \
+        {                                                                                                   \
+            static const jyl::BinLogSite s_jyl_bin_site(level, __FILE__, __LINE__, fmt,                     \
+                                                        decltype(jyl::detail::MakeBinTypes(__VA_ARGS__))::str()); \
+            jyl::BinLogWrite(logger, s_jyl_bin_site, ##__VA_ARGS__);                                        \
+        }                                                                                                   \
+    } while (0)
+
+// 按调用点采样，和JYL_LOG_SAMPLED一样；有跳过的日志时换用带"[n suppressed] "前缀的调用点
+#define JYL_LOG_BIN_SAMPLED(logger, level, sample, fmt, ...)                                                \
+    do                                                                                                      \
+    {                                                                                                       \
+        static_assert(jyl::detail::CountPlaceholders(fmt) ==                                                \
+                          decltype(jyl::detail::MakeArgCount(__VA_ARGS__))::value,                          \
+                      "placeholders and arguments do not match: " fmt);                                    \
+        if (level >= JYL_LOG_ACTIVE_LEVEL && logger->getLevel() <= level)                                   \
+        {                                                                                                   \
+            jyl::LogSample jyl_log_sample = JYL_LOG_SAMPLER().sample;                                       \
+            if (jyl_log_sample && jyl_log_sample.suppressed == 0)                                           \
+            {                                                                                               \
+                static const jyl::BinLogSite s_jyl_bin_site(level, __FILE__, __LINE__, fmt,                 \
+                                                            decltype(jyl::detail::MakeBinTypes(__VA_ARGS__))::str()); \
+                jyl::BinLogWrite(logger, s_jyl_bin_site, ##__VA_ARGS__);                                    \
+            }                                                                                               \
+            else if (jyl_log_sample)                                                                        \
+            {                                                                                               \
+                static const jyl::BinLogSite s_jyl_bin_site(                                                \
+                    level, __FILE__, __LINE__, "[{} suppressed] " fmt,                                      \
+                    decltype(jyl::detail::MakeBinTypes(jyl_log_sample.suppressed, ##__VA_ARGS__))::str());  \
+                jyl::BinLogWrite(logger, s_jyl_bin_site, jyl_log_sample.suppressed, ##__VA_ARGS__);         \
+            }                                                                                               \
+        }                                                                                                   \
+    } while (0)
+
+#define JYL_LOG_BIN_EVERY_N(logger, level, n, fmt, ...) JYL_LOG_BIN_SAMPLED(logger, level, everyN(n), fmt, ##__VA_ARGS__)
+#define JYL_LOG_BIN_FIRST_N(logger, level, n, fmt, ...) JYL_LOG_BIN_SAMPLED(logger, level, firstN(n), fmt, ##__VA_ARGS__)
+#define JYL_LOG_BIN_EVERY_MS(logger, level, ms, fmt, ...) JYL_LOG_BIN_SAMPLED(logger, level, everyMS(ms), fmt, ##__VA_ARGS__)
+
+#define JYL_LOG_BIN_DEBUG(logger, fmt, ...) JYL_LOG_BIN_LEVEL(logger, jyl::LogLevel::DEBUG, fmt, ##__VA_ARGS__)
+#define JYL_LOG_BIN_INFO(logger, fmt, ...) JYL_LOG_BIN_LEVEL(logger, jyl::LogLevel::INFO, fmt, ##__VA_ARGS__)
+#define JYL_LOG_BIN_WARN(logger, fmt, ...) JYL_LOG_BIN_LEVEL(logger, jyl::LogLevel::WARN, fmt, ##__VA_ARGS__)
+#define JYL_LOG_BIN_ERROR(logger, fmt, ...) JYL_LOG_BIN_LEVEL(logger, jyl::LogLevel::ERROR, fmt, ##__VA_ARGS__)
+#define JYL_LOG_BIN_FATAL(logger, fmt, ...) JYL_LOG_BIN_LEVEL(logger, jyl::LogLevel::FATAL, fmt, ##__VA_ARGS__)
+
+namespace jyl
+{
+    // 调用点的静态信息，每个调用点一个静态对象
+    struct BinLogSite
+    {
+        BinLogSite(LogLevel::Level level, const char *file, int32_t line, const char *fmt, const char *types);
+
+        uint32_t id;           // 进程内唯一
+        LogLevel::Level level;
+        const char *file;
+        int32_t line;
+        const char *fmt;
+        const char *types;     // 每个参数一个类型字符，见BinArg
+    };
+
+    namespace detail
+    {
+        // 参数类型：i有符号整数 u无符号整数 d浮点 b bool c char s字符串，按本机字节序编码
+        template <class T, class Enable = void>
+        struct BinArg; // 没有定义的类型不支持
+
+        template <class T>
+        struct BinArg<T, typename enable_if<is_integral<T>::value && is_signed<T>::value && !is_same<T, char>::value>::type>
+        {
+            static const char type = 'i';
+            static void encode(string &buf, T v)
+            {
+                int64_t x = v;
+                buf.append((const char *)&x, sizeof(x));
+            }
+        };
+        template <class T>
+        struct BinArg<T, typename enable_if<is_integral<T>::value && !is_signed<T>::value && !is_same<T, bool>::value && !is_same<T, char>::value>::type>
+        {
+            static const char type = 'u';
+            static void encode(string &buf, T v)
+            {
+                uint64_t x = v;
+                buf.append((const char *)&x, sizeof(x));
+            }
+        };
+        template <class T>
+        struct BinArg<T, typename enable_if<is_floating_point<T>::value>::type>
+        {
+            static const char type = 'd';
+            static void encode(string &buf, T v)
+            {
+                double x = v;
+                buf.append((const char *)&x, sizeof(x));
+            }
+        };
+        template <>
+        struct BinArg<bool>
+        {
+            static const char type = 'b';
+            static void encode(string &buf, bool v) { buf.append(1, v ? 1 : 0); }
+        };
+        template <>
+        struct BinArg<char>
+        {
+            static const char type = 'c';
+            static void encode(string &buf, char v) { buf.append(1, v); }
+        };
+        inline void EncodeBinString(string &buf, const char *data, uint32_t len)
+        {
+            buf.append((const char *)&len, sizeof(len));
+            buf.append(data, len);
+        }
+        template <>
+        struct BinArg<const char *>
+        {
+            static const char type = 's';
+            static void encode(string &buf, const char *v) { EncodeBinString(buf, v ? v : "", v ? strlen(v) : 0); }
+        };
+        template <>
+        struct BinArg<char *> : public BinArg<const char *>
+        {
+        };
+        template <>
+        struct BinArg<string>
+        {
+            static const char type = 's';
+            static void encode(string &buf, const string &v) { EncodeBinString(buf, v.data(), v.size()); }
+        };
+
+        template <class... Args>
+        struct BinTypes
+        {
+            static const char *str()
+            {
+                static const char s[] = {BinArg<Args>::type..., '\0'};
+                return s;
+            }
+        };
+        // 只在decltype里用，参数不会被求值
+        template <class... Args>
+        BinTypes<typename decay<Args>::type...> MakeBinTypes(const Args &...);
+
+        inline void BinEncode(string &) {}
+        template <class T, class... Args>
+        void BinEncode(string &buf, const T &v, const Args &...args)
+        {
+            BinArg<typename decay<T>::type>::encode(buf, v);
+            BinEncode(buf, args...);
+        }
+
+        // 编码参数用的线程缓存
+        string &BinLogBuffer();
+        // 按site的格式串和类型把参数还原成文本，参数不完整返回false
+        bool BinDecode(LogStream &os, const char *fmt, const char *types, const char *args, size_t len);
+    }
+
+    template <class... Args>
+    void BinLogWrite(const Logger::ptr &logger, const BinLogSite &site, const Args &...args)
+    {
+        string &buf = detail::BinLogBuffer();
+        buf.clear();
+        detail::BinEncode(buf, args...);
+        logger->logBinary(site, buf.data(), buf.size(), getRealTimeUS());
+    }
+
+    /*
+        二进制日志文件，格式(本机字节序)：
+        文件头 "JYLBLOG" '\0' u32版本
+        记录   u8类型 + 内容
+          1 调用点  u32 id, u8 level, i32 line, u16+file, u16+fmt, u16+types
+          2 logger  u32 id, u16+name
+          3 事件    u32 site, u32 logger, u64 time_us, u32 elapse, u32 thread, u32 fiber, u32+args
+          4 文本    u32 logger, u8 level, u64 time_us, u32 elapse, u32 thread, u32 fiber, i32 line, u16+file, u32+内容
+        版本1的事件和文本记录没有elapse。
+        调用点和logger在每个文件里第一次用到时写入，切分和重新打开后重新写。
+        每个线程先把记录编码到自己的缓存里，攒到kThreadBufferSize、遇到ERROR或者后台刷新时整段交给文件缓存，
+        所以不同线程的记录在文件里按段交错，不严格按时间排序
+    */
+    class BinaryLogAppender : public FileLogAppender
+    {
+    public:
+        typedef shared_ptr<BinaryLogAppender> ptr;
+        static const char kMagic[8];
+        static const uint32_t kVersion = 2;
+        static const size_t kThreadBufferSize = 16 * 1024;
+        enum RecordType : uint8_t
+        {
+            RECORD_SITE = 1,
+            RECORD_LOGGER,
+            RECORD_EVENT,
+            RECORD_TEXT
+        };
+
+        BinaryLogAppender(const string &filename, size_t buffer_size = 1024 * 1024, uint32_t flush_interval = 1000);
+        ~BinaryLogAppender();
+        // 普通的文本事件，内容已经格式化好了
+        void log(Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event) override;
+        bool logBinary(Logger *logger, const BinLogSite &site, const char *args, size_t len,
+                       uint64_t time_us, uint32_t elapse, uint32_t thread_id, uint32_t fiber_id) override;
+        // 先收集各线程缓存里的记录，再写文件
+        void flush() override;
+
+    protected:
+        void onFileOpened() override;
+
+    private:
+        // 一个线程还没交给文件缓存的记录，以及其中用到的调用点和logger
+        struct ThreadBuffer
+        {
+            mutex mtx;                              // 只有flush和线程退出会和写日志的线程竞争
+            string buf;
+            vector<const BinLogSite *> sites;
+            vector<bool> listed;                    // 调用点是否已经在sites里，按id
+            vector<pair<uint32_t, string>> loggers; // logger id -> 名称
+            LogLevel::Level level = LogLevel::DEBUG; // buf里最高的级别
+        };
+        // 所有线程的缓存，线程退出时通过weak_ptr找到
+        struct ThreadBuffers
+        {
+            mutex mtx;
+            BinaryLogAppender *owner = nullptr;            // appender析构后为空
+            map<uint32_t, shared_ptr<ThreadBuffer>> live; // 线程id -> 缓存
+        };
+        // 当前线程的缓存，线程正在退出时返回nullptr
+        ThreadBuffer *getThreadBuffer();
+        void listSite(ThreadBuffer &tb, const BinLogSite &site);
+        void listLogger(ThreadBuffer &tb, const Logger *logger);
+        // 把tb整段交给文件缓存，先补上当前文件还没有的调用点和logger，持有tb.mtx时调用
+        void handOff(ThreadBuffer &tb);
+        void loggerLocked(uint32_t id, const string &name);
+        void siteLocked(const BinLogSite &site);
+
+    private:
+        uint64_t m_id; // 进程内唯一，用于线程缓存
+        shared_ptr<ThreadBuffers> m_threads;
+        vector<bool> m_sites;   // 当前文件已经写过的调用点，按id
+        vector<bool> m_loggers; // 当前文件已经写过的logger，按Logger::getId
+    };
+}
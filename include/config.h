@@ -10,19 +10,44 @@
 #include <set>
 #include <unordered_map>
 #include <unordered_set>
+#include <algorithm>
+#include <typeinfo>
 #include <boost/lexical_cast.hpp>
-#include "/usr/local/include/yaml-cpp/yaml.h"
 #include <yaml-cpp/yaml.h>
 #include "../include/log.h"
+#include "../include/snapshot.h"
 
 using namespace std;
 
 namespace jyl
 {
+    // 标量取原文，其它节点序列化成yaml文本
+    inline string NodeToString(const YAML::Node &node)
+    {
+        if (node.IsScalar())
+        {
+            return node.Scalar();
+        }
+        stringstream ss;
+        ss << node;
+        return ss.str();
+    }
+
     class ConfigVarBase
     {
     public:
         typedef shared_ptr<ConfigVarBase> ptr;
+
+        // 分两步的修改：publish让新值生效，notify调用回调。批量修改时先全部publish再统一notify
+        class Change
+        {
+        public:
+            typedef shared_ptr<Change> ptr;
+            virtual ~Change() {}
+            virtual void publish() = 0;
+            virtual void notify() = 0;
+        };
+
         ConfigVarBase(const string &name, const string &description)
             : m_name(name), m_description(description)
         {
@@ -36,6 +61,15 @@ namespace jyl
         virtual string toString() = 0;
         virtual bool fromString(const string &val) = 0;
         virtual string getTypeName() const = 0;
+        // 直接从yaml节点加载/导出，默认经过字符串
+        virtual bool fromNode(const YAML::Node &node) { return fromString(NodeToString(node)); }
+        virtual YAML::Node toNode() { return YAML::Load(toString()); }
+        // 解析出新值但不生效，值没变时change为空；解析失败返回false
+        virtual bool prepare(const YAML::Node &node, Change::ptr &change);
+        // 配置快照里的二进制值，默认就是字符串形式
+        virtual void toBinary(string &out) { out = toString(); }
+        // 和prepare一样只解码不生效，值没变时change为空；解码失败返回false
+        virtual bool prepareBinary(const char *data, size_t len, Change::ptr &change);
 
     protected:
         string m_name;
@@ -53,241 +87,768 @@ namespace jyl
         }
     };
 
+    // YAML::Node直接转成T，容器逐个元素递归转换，不经过字符串。
+    // 没有特化的类型退回到字符串的LexicalCast，自定义类型可以特化FromNode/ToNode省掉解析
+    template <class T, class Enable = void>
+    class FromNode
+    {
+    public:
+        T operator()(const YAML::Node &node)
+        {
+            return LexicalCast<string, T>()(NodeToString(node));
+        }
+    };
+
+    template <class T, class Enable = void>
+    class ToNode
+    {
+    public:
+        YAML::Node operator()(const T &val)
+        {
+            return YAML::Load(LexicalCast<T, string>()(val));
+        }
+    };
+
+    // 数值和字符串直接做成标量节点，不用再解析一遍
     template <class T>
-    class LexicalCast<string, vector<T>>
+    class ToNode<T, typename enable_if<is_arithmetic<T>::value>::type>
     {
     public:
-        vector<T> operator()(const string &val)
+        YAML::Node operator()(const T &val)
+        {
+            return YAML::Node(LexicalCast<T, string>()(val));
+        }
+    };
+
+    template <>
+    class ToNode<string>
+    {
+    public:
+        YAML::Node operator()(const string &val)
+        {
+            return YAML::Node(val);
+        }
+    };
+
+    template <class T>
+    class FromNode<vector<T>>
+    {
+    public:
+        vector<T> operator()(const YAML::Node &node)
         {
-            YAML::Node node = YAML::Load(val);
             vector<T> vec;
-            stringstream ss;
             for (size_t i = 0; i < node.size(); ++i)
             {
-                ss.str("");
-                ss << node[i];
-                vec.push_back(LexicalCast<string, T>()(ss.str()));
+                vec.push_back(FromNode<T>()(node[i]));
             }
             return vec;
         }
     };
 
     template <class T>
-    class LexicalCast<vector<T>, string>
+    class ToNode<vector<T>>
     {
     public:
-        string operator()(const vector<T> &val)
+        YAML::Node operator()(const vector<T> &val)
         {
-            YAML::Node node;
+            YAML::Node node(YAML::NodeType::Sequence);
             for (auto &v : val)
             {
-                node.push_back(YAML::Load(LexicalCast<T, string>()(v)));
+                node.push_back(ToNode<T>()(v));
             }
-            stringstream ss;
-            ss << node;
-            return ss.str();
+            return node;
         }
     };
 
     template <class T>
-    class LexicalCast<string, list<T>>
+    class FromNode<list<T>>
     {
     public:
-        list<T> operator()(const string &val)
+        list<T> operator()(const YAML::Node &node)
         {
-            YAML::Node node = YAML::Load(val);
             list<T> vec;
-            stringstream ss;
             for (size_t i = 0; i < node.size(); ++i)
             {
-                ss.str("");
-                ss << node[i];
-                vec.push_back(LexicalCast<string, T>()(ss.str()));
+                vec.push_back(FromNode<T>()(node[i]));
             }
             return vec;
         }
     };
 
     template <class T>
-    class LexicalCast<list<T>, string>
+    class ToNode<list<T>>
     {
     public:
-        string operator()(const list<T> &val)
+        YAML::Node operator()(const list<T> &val)
         {
-            YAML::Node node;
+            YAML::Node node(YAML::NodeType::Sequence);
             for (auto &v : val)
             {
-                node.push_back(YAML::Load(LexicalCast<T, string>()(v)));
+                node.push_back(ToNode<T>()(v));
             }
-            stringstream ss;
-            ss << node;
-            return ss.str();
+            return node;
         }
     };
 
     template <class T>
-    class LexicalCast<string, set<T>>
+    class FromNode<set<T>>
     {
     public:
-        set<T> operator()(const string &val)
+        set<T> operator()(const YAML::Node &node)
         {
-            YAML::Node node = YAML::Load(val);
             set<T> vec;
-            stringstream ss;
             for (size_t i = 0; i < node.size(); ++i)
             {
-                ss.str("");
-                ss << node[i];
-                vec.insert(LexicalCast<string, T>()(ss.str()));
+                vec.insert(FromNode<T>()(node[i]));
             }
             return vec;
         }
     };
 
     template <class T>
-    class LexicalCast<set<T>, string>
+    class ToNode<set<T>>
     {
     public:
-        string operator()(const set<T> &val)
+        YAML::Node operator()(const set<T> &val)
         {
-            YAML::Node node;
+            YAML::Node node(YAML::NodeType::Sequence);
             for (auto &v : val)
             {
-                node.push_back(YAML::Load(LexicalCast<T, string>()(v)));
+                node.push_back(ToNode<T>()(v));
             }
-            stringstream ss;
-            ss << node;
-            return ss.str();
+            return node;
         }
     };
 
     template <class T>
-    class LexicalCast<string, unordered_set<T>>
+    class FromNode<unordered_set<T>>
     {
     public:
-        unordered_set<T> operator()(const string &val)
+        unordered_set<T> operator()(const YAML::Node &node)
         {
-            YAML::Node node = YAML::Load(val);
             unordered_set<T> vec;
-            stringstream ss;
             for (size_t i = 0; i < node.size(); ++i)
             {
-                ss.str("");
-                ss << node[i];
-                vec.insert(LexicalCast<string, T>()(ss.str()));
+                vec.insert(FromNode<T>()(node[i]));
             }
             return vec;
         }
     };
 
     template <class T>
-    class LexicalCast<unordered_set<T>, string>
+    class ToNode<unordered_set<T>>
     {
     public:
-        string operator()(const unordered_set<T> &val)
+        YAML::Node operator()(const unordered_set<T> &val)
         {
-            YAML::Node node;
+            YAML::Node node(YAML::NodeType::Sequence);
             for (auto &v : val)
             {
-                node.push_back(YAML::Load(LexicalCast<T, string>()(v)));
+                node.push_back(ToNode<T>()(v));
             }
-            stringstream ss;
-            ss << node;
-            return ss.str();
+            return node;
         }
     };
 
     template <class T>
-    class LexicalCast<string, map<string, T>>
+    class FromNode<map<string, T>>
     {
     public:
-        map<string, T> operator()(const string &val)
+        map<string, T> operator()(const YAML::Node &node)
         {
-            YAML::Node node = YAML::Load(val);
             map<string, T> vec;
-            stringstream ss;
             for (auto it = node.begin(); it != node.end(); ++it)
             {
-                ss.str("");
-                ss << it->second;
-                vec.insert(make_pair(it->first.Scalar(), LexicalCast<string, T>()(ss.str())));
+                vec.insert(make_pair(it->first.Scalar(), FromNode<T>()(it->second)));
             }
             return vec;
         }
     };
 
     template <class T>
-    class LexicalCast<map<string, T>, string>
+    class ToNode<map<string, T>>
     {
     public:
-        string operator()(const map<string, T> &val)
+        YAML::Node operator()(const map<string, T> &val)
         {
-            YAML::Node node;
+            YAML::Node node(YAML::NodeType::Map);
             for (auto &v : val)
             {
-                node[v.first] = YAML::Load(LexicalCast<T, string>()(v.second));
+                node[v.first] = ToNode<T>()(v.second);
             }
-            stringstream ss;
-            ss << node;
-            return ss.str();
+            return node;
         }
     };
 
     template <class T>
-    class LexicalCast<string, unordered_map<string, T>>
+    class FromNode<unordered_map<string, T>>
     {
     public:
-        unordered_map<string, T> operator()(const string &val)
+        unordered_map<string, T> operator()(const YAML::Node &node)
         {
-            YAML::Node node = YAML::Load(val);
             unordered_map<string, T> vec;
-            stringstream ss;
             for (auto it = node.begin(); it != node.end(); ++it)
             {
-                ss.str("");
-                ss << it->second;
-                vec.insert(make_pair(it->first.Scalar(), LexicalCast<string, T>()(ss.str())));
+                vec.insert(make_pair(it->first.Scalar(), FromNode<T>()(it->second)));
             }
             return vec;
         }
     };
 
     template <class T>
-    class LexicalCast<unordered_map<string, T>, string>
+    class ToNode<unordered_map<string, T>>
     {
     public:
-        string operator()(const unordered_map<string, T> &val)
+        YAML::Node operator()(const unordered_map<string, T> &val)
         {
-            YAML::Node node;
+            YAML::Node node(YAML::NodeType::Map);
             for (auto &v : val)
             {
-                node[v.first] = YAML::Load(LexicalCast<T, string>()(v.second));
+                node[v.first] = ToNode<T>()(v.second);
             }
+            return node;
+        }
+    };
+
+    // 容器和字符串互转：解析一次成节点，再按节点转换
+
+    template <class T>
+    class LexicalCast<string, vector<T>>
+    {
+    public:
+        vector<T> operator()(const string &val)
+        {
+            return FromNode<vector<T>>()(YAML::Load(val));
+        }
+    };
+
+    template <class T>
+    class LexicalCast<vector<T>, string>
+    {
+    public:
+        string operator()(const vector<T> &val)
+        {
+            stringstream ss;
+            ss << ToNode<vector<T>>()(val);
+            return ss.str();
+        }
+    };
+
+    template <class T>
+    class LexicalCast<string, list<T>>
+    {
+    public:
+        list<T> operator()(const string &val)
+        {
+            return FromNode<list<T>>()(YAML::Load(val));
+        }
+    };
+
+    template <class T>
+    class LexicalCast<list<T>, string>
+    {
+    public:
+        string operator()(const list<T> &val)
+        {
             stringstream ss;
-            ss << node;
+            ss << ToNode<list<T>>()(val);
             return ss.str();
         }
     };
 
+    template <class T>
+    class LexicalCast<string, set<T>>
+    {
+    public:
+        set<T> operator()(const string &val)
+        {
+            return FromNode<set<T>>()(YAML::Load(val));
+        }
+    };
+
+    template <class T>
+    class LexicalCast<set<T>, string>
+    {
+    public:
+        string operator()(const set<T> &val)
+        {
+            stringstream ss;
+            ss << ToNode<set<T>>()(val);
+            return ss.str();
+        }
+    };
+
+    template <class T>
+    class LexicalCast<string, unordered_set<T>>
+    {
+    public:
+        unordered_set<T> operator()(const string &val)
+        {
+            return FromNode<unordered_set<T>>()(YAML::Load(val));
+        }
+    };
+
+    template <class T>
+    class LexicalCast<unordered_set<T>, string>
+    {
+    public:
+        string operator()(const unordered_set<T> &val)
+        {
+            stringstream ss;
+            ss << ToNode<unordered_set<T>>()(val);
+            return ss.str();
+        }
+    };
+
+    template <class T>
+    class LexicalCast<string, map<string, T>>
+    {
+    public:
+        map<string, T> operator()(const string &val)
+        {
+            return FromNode<map<string, T>>()(YAML::Load(val));
+        }
+    };
+
+    template <class T>
+    class LexicalCast<map<string, T>, string>
+    {
+    public:
+        string operator()(const map<string, T> &val)
+        {
+            stringstream ss;
+            ss << ToNode<map<string, T>>()(val);
+            return ss.str();
+        }
+    };
+
+    template <class T>
+    class LexicalCast<string, unordered_map<string, T>>
+    {
+    public:
+        unordered_map<string, T> operator()(const string &val)
+        {
+            return FromNode<unordered_map<string, T>>()(YAML::Load(val));
+        }
+    };
+
+    template <class T>
+    class LexicalCast<unordered_map<string, T>, string>
+    {
+    public:
+        string operator()(const unordered_map<string, T> &val)
+        {
+            stringstream ss;
+            ss << ToNode<unordered_map<string, T>>()(val);
+            return ss.str();
+        }
+    };
+
+    // 配置快照里值的二进制编码：数值按内存布局，字符串和容器带长度前缀。
+    // 没有特化的类型借用ToNode/FromNode存成yaml文本
+    inline void PutBinaryString(string &out, const string &val)
+    {
+        uint32_t len = val.size();
+        out.append((const char *)&len, sizeof(len));
+        out.append(val);
+    }
+
+    class BinaryReader
+    {
+    public:
+        BinaryReader(const char *data, size_t len) : m_p(data), m_end(data + len) {}
+        bool read(void *dst, size_t len)
+        {
+            if ((size_t)(m_end - m_p) < len)
+            {
+                return false;
+            }
+            memcpy(dst, m_p, len);
+            m_p += len;
+            return true;
+        }
+        bool readString(string &val)
+        {
+            uint32_t len = 0;
+            if (!read(&len, sizeof(len)) || (size_t)(m_end - m_p) < len)
+            {
+                return false;
+            }
+            val.assign(m_p, len);
+            m_p += len;
+            return true;
+        }
+        // 读容器的元素个数，每个元素至少占一个字节，个数不会超过剩下的字节数
+        bool readCount(uint32_t &count)
+        {
+            return read(&count, sizeof(count)) && count <= (size_t)(m_end - m_p);
+        }
+        bool skip(size_t len)
+        {
+            if ((size_t)(m_end - m_p) < len)
+            {
+                return false;
+            }
+            m_p += len;
+            return true;
+        }
+        size_t remaining() const { return m_end - m_p; }
+        bool eof() const { return m_p == m_end; }
+
+    private:
+        const char *m_p;
+        const char *m_end;
+    };
+
+    template <class T, class Enable = void>
+    class ToBinary
+    {
+    public:
+        void operator()(const T &val, string &out)
+        {
+            PutBinaryString(out, NodeToString(ToNode<T>()(val)));
+        }
+    };
+
+    template <class T, class Enable = void>
+    class FromBinary
+    {
+    public:
+        bool operator()(BinaryReader &in, T &val)
+        {
+            string str;
+            if (!in.readString(str))
+            {
+                return false;
+            }
+            val = FromNode<T>()(YAML::Load(str));
+            return true;
+        }
+    };
+
+    template <class T>
+    class ToBinary<T, typename enable_if<is_arithmetic<T>::value>::type>
+    {
+    public:
+        void operator()(const T &val, string &out)
+        {
+            out.append((const char *)&val, sizeof(val));
+        }
+    };
+
+    template <class T>
+    class FromBinary<T, typename enable_if<is_arithmetic<T>::value>::type>
+    {
+    public:
+        bool operator()(BinaryReader &in, T &val)
+        {
+            return in.read(&val, sizeof(val));
+        }
+    };
+
+    // 不是0或1的字节读成bool是未定义行为，按损坏处理
+    template <>
+    class FromBinary<bool>
+    {
+    public:
+        bool operator()(BinaryReader &in, bool &val)
+        {
+            uint8_t v = 0;
+            if (!in.read(&v, sizeof(v)) || v > 1)
+            {
+                return false;
+            }
+            val = v;
+            return true;
+        }
+    };
+
+    template <>
+    class ToBinary<string>
+    {
+    public:
+        void operator()(const string &val, string &out)
+        {
+            PutBinaryString(out, val);
+        }
+    };
+
+    template <>
+    class FromBinary<string>
+    {
+    public:
+        bool operator()(BinaryReader &in, string &val)
+        {
+            return in.readString(val);
+        }
+    };
+
+    template <class T>
+    class ToBinary<vector<T>>
+    {
+    public:
+        void operator()(const vector<T> &val, string &out)
+        {
+            uint32_t count = val.size();
+            out.append((const char *)&count, sizeof(count));
+            for (auto &v : val)
+            {
+                ToBinary<T>()(v, out);
+            }
+        }
+    };
+
+    template <class T>
+    class FromBinary<vector<T>>
+    {
+    public:
+        bool operator()(BinaryReader &in, vector<T> &val)
+        {
+            uint32_t count = 0;
+            if (!in.readCount(count))
+            {
+                return false;
+            }
+            val.clear();
+            for (uint32_t i = 0; i < count; ++i)
+            {
+                T v;
+                if (!FromBinary<T>()(in, v))
+                {
+                    return false;
+                }
+                val.push_back(move(v));
+            }
+            return true;
+        }
+    };
+
+    template <class T>
+    class ToBinary<list<T>>
+    {
+    public:
+        void operator()(const list<T> &val, string &out)
+        {
+            uint32_t count = val.size();
+            out.append((const char *)&count, sizeof(count));
+            for (auto &v : val)
+            {
+                ToBinary<T>()(v, out);
+            }
+        }
+    };
+
+    template <class T>
+    class FromBinary<list<T>>
+    {
+    public:
+        bool operator()(BinaryReader &in, list<T> &val)
+        {
+            uint32_t count = 0;
+            if (!in.readCount(count))
+            {
+                return false;
+            }
+            val.clear();
+            for (uint32_t i = 0; i < count; ++i)
+            {
+                T v;
+                if (!FromBinary<T>()(in, v))
+                {
+                    return false;
+                }
+                val.push_back(move(v));
+            }
+            return true;
+        }
+    };
+
+    template <class T>
+    class ToBinary<set<T>>
+    {
+    public:
+        void operator()(const set<T> &val, string &out)
+        {
+            uint32_t count = val.size();
+            out.append((const char *)&count, sizeof(count));
+            for (auto &v : val)
+            {
+                ToBinary<T>()(v, out);
+            }
+        }
+    };
+
+    template <class T>
+    class FromBinary<set<T>>
+    {
+    public:
+        bool operator()(BinaryReader &in, set<T> &val)
+        {
+            uint32_t count = 0;
+            if (!in.readCount(count))
+            {
+                return false;
+            }
+            val.clear();
+            for (uint32_t i = 0; i < count; ++i)
+            {
+                T v;
+                if (!FromBinary<T>()(in, v))
+                {
+                    return false;
+                }
+                val.insert(move(v));
+            }
+            return true;
+        }
+    };
+
+    template <class T>
+    class ToBinary<unordered_set<T>>
+    {
+    public:
+        void operator()(const unordered_set<T> &val, string &out)
+        {
+            uint32_t count = val.size();
+            out.append((const char *)&count, sizeof(count));
+            for (auto &v : val)
+            {
+                ToBinary<T>()(v, out);
+            }
+        }
+    };
+
+    template <class T>
+    class FromBinary<unordered_set<T>>
+    {
+    public:
+        bool operator()(BinaryReader &in, unordered_set<T> &val)
+        {
+            uint32_t count = 0;
+            if (!in.readCount(count))
+            {
+                return false;
+            }
+            val.clear();
+            for (uint32_t i = 0; i < count; ++i)
+            {
+                T v;
+                if (!FromBinary<T>()(in, v))
+                {
+                    return false;
+                }
+                val.insert(move(v));
+            }
+            return true;
+        }
+    };
+
+    template <class T>
+    class ToBinary<map<string, T>>
+    {
+    public:
+        void operator()(const map<string, T> &val, string &out)
+        {
+            uint32_t count = val.size();
+            out.append((const char *)&count, sizeof(count));
+            for (auto &v : val)
+            {
+                PutBinaryString(out, v.first);
+                ToBinary<T>()(v.second, out);
+            }
+        }
+    };
+
+    template <class T>
+    class FromBinary<map<string, T>>
+    {
+    public:
+        bool operator()(BinaryReader &in, map<string, T> &val)
+        {
+            uint32_t count = 0;
+            if (!in.readCount(count))
+            {
+                return false;
+            }
+            val.clear();
+            for (uint32_t i = 0; i < count; ++i)
+            {
+                string key;
+                T v;
+                if (!in.readString(key) || !FromBinary<T>()(in, v))
+                {
+                    return false;
+                }
+                val.insert(make_pair(move(key), move(v)));
+            }
+            return true;
+        }
+    };
+
+    template <class T>
+    class ToBinary<unordered_map<string, T>>
+    {
+    public:
+        void operator()(const unordered_map<string, T> &val, string &out)
+        {
+            uint32_t count = val.size();
+            out.append((const char *)&count, sizeof(count));
+            for (auto &v : val)
+            {
+                PutBinaryString(out, v.first);
+                ToBinary<T>()(v.second, out);
+            }
+        }
+    };
+
+    template <class T>
+    class FromBinary<unordered_map<string, T>>
+    {
+    public:
+        bool operator()(BinaryReader &in, unordered_map<string, T> &val)
+        {
+            uint32_t count = 0;
+            if (!in.readCount(count))
+            {
+                return false;
+            }
+            val.clear();
+            for (uint32_t i = 0; i < count; ++i)
+            {
+                string key;
+                T v;
+                if (!in.readString(key) || !FromBinary<T>()(in, v))
+                {
+                    return false;
+                }
+                val.insert(make_pair(move(key), move(v)));
+            }
+            return true;
+        }
+    };
+
     // FromStr T operator() (const string&)
     // ToStr string operator()(const T&)
+    // fromNode/toNode用FromNode<T>/ToNode<T>；指定了自己的FromStr/ToStr时改走字符串，保证两条路结果一致
     // 配置信息的类，一条配置信息就是一个对象
     template <class T, class FromStr = LexicalCast<string, T>, class ToStr = LexicalCast<T, string>>
     class ConfigVar : public ConfigVarBase
     {
     public:
         typedef std::shared_ptr<ConfigVar> ptr;
-        typedef function<void(const &old_val, const T &new_val)> on_change_cb;
+        typedef function<void(const T &old_val, const T &new_val)> on_change_cb;
+        typedef shared_ptr<const T> ConstPtr;
+        typedef typename Snapshot<T>::Ref Ref;
 
         ConfigVar(const string &name, const T &default_val, const string &description)
-            : ConfigVarBase(name, description), m_val(default_val) {}
+            : ConfigVarBase(name, description), m_val(make_shared<const T>(default_val)) {}
 
         string toString() override
         {
             try
             {
                 // return boost::lexical_cast<string>(m_val);
-                return ToStr()(m_val);
+                return ToStr()(*m_val.ref());
             }
             catch (exception &e)
             {
@@ -309,35 +870,180 @@ namespace jyl
             }
             return false;
         }
-        const T getValue() const { return m_val; }
-        void setValue(const T &val)
+        bool fromNode(const YAML::Node &node) override
+        {
+            try
+            {
+                setValue(decodeNode(node, DefaultFrom()));
+                return true;
+            }
+            catch (exception &e)
+            {
+                /*log 日志*/
+            }
+            return false;
+        }
+        YAML::Node toNode() override { return encodeNode(DefaultTo()); }
+        void toBinary(string &out) override { encodeBinary(out, DefaultTo()); }
+        bool prepareBinary(const char *data, size_t len, Change::ptr &change) override
         {
-            // 这里进行比较需要对自定义的类的 == 进行重载
-            if (val == m_val)
+            try
             {
-                return;
+                ConstPtr val = decodeBinary(data, len, DefaultFrom());
+                if (!val)
+                {
+                    return false;
+                }
+                change.reset();
+                if (!(*val == *m_val.ref()))
+                {
+                    change.reset(new ValueChange(this, val));
+                }
+                return true;
             }
-            for (auto &i : m_cbs)
+            catch (exception &e)
             {
-                i.second(m_val, val);
+                /*log 日志*/
             }
-            m_val = val;
+            return false;
+        }
+        bool prepare(const YAML::Node &node, Change::ptr &change) override
+        {
+            try
+            {
+                ConstPtr val = make_shared<const T>(decodeNode(node, DefaultFrom()));
+                change.reset();
+                if (!(*val == *m_val.ref()))
+                {
+                    change.reset(new ValueChange(this, val));
+                }
+                return true;
+            }
+            catch (exception &e)
+            {
+                /*log 日志*/
+            }
+            return false;
+        }
+        // 返回一份拷贝，值是大容器时用getRef()或snapshot()
+        const T getValue() const { return *m_val.ref(); }
+        // 读当前版本，不加锁也不复制，Ref存活期间旧版本不会被释放；只在当前线程短时间持有
+        Ref getRef() const { return m_val.ref(); }
+        // 持有当前版本，要加锁但不复制值，适合需要长时间保留或交给其它线程的地方
+        ConstPtr snapshot() const { return m_val.get(); }
+        // 新值生效后在锁外调用回调，回调里可以再setValue(包括同一个配置项)
+        void setValue(const T &val)
+        {
+            ConstPtr old_val;
+            ConstPtr new_val;
+            {
+                lock_guard<mutex> lock(m_writeMutex);
+                old_val = m_val.get();
+                // 这里进行比较需要对自定义的类的 == 进行重载
+                if (val == *old_val)
+                {
+                    return;
+                }
+                // 读者要么看到完整的旧版本，要么看到完整的新版本
+                new_val = make_shared<const T>(val);
+                m_val.store(new_val);
+            }
+            notify(*old_val, *new_val);
         }
         string getTypeName() const override { return typeid(T).name(); }
-        void addListener(uint64_t key, const on_change_cb &cb) { m_cbs[key] = cb; }
-        void delListener(uint64_t key) { m_cbs.erase(key); }
+        // 回调集合也是写时复制，回调执行期间增删回调不影响这一轮通知
+        void addListener(uint64_t key, const on_change_cb &cb)
+        {
+            m_cbs.update([&](map<uint64_t, on_change_cb> &cbs)
+                         { cbs[key] = cb; });
+        }
+        void delListener(uint64_t key)
+        {
+            m_cbs.update([&](map<uint64_t, on_change_cb> &cbs)
+                         { cbs.erase(key); });
+        }
         on_change_cb getListener(uint64_t key)
         {
-            auto it = m_cbs.find(key);
-            return it == nullptr ? nullptr : it->second;
+            return m_cbs.read([&](const map<uint64_t, on_change_cb> &cbs)
+                              {
+                                  auto it = cbs.find(key);
+                                  return it == cbs.end() ? nullptr : it->second; });
         }
-        void clearListener() { m_cbs.clear(); }
+        void clearListener() { m_cbs.store(make_shared<const map<uint64_t, on_change_cb>>()); }
 
     private:
-        T m_val;
+        // 用的是不是默认的转换。按true_type/false_type重载选择路径，自定义了FromStr/ToStr时
+        // 不会实例化FromNode/ToNode/FromBinary/ToBinary，T不需要支持LexicalCast
+        typedef integral_constant<bool, is_same<FromStr, LexicalCast<string, T>>::value> DefaultFrom;
+        typedef integral_constant<bool, is_same<ToStr, LexicalCast<T, string>>::value> DefaultTo;
+
+        T decodeNode(const YAML::Node &node, true_type) { return FromNode<T>()(node); }
+        T decodeNode(const YAML::Node &node, false_type) { return FromStr()(NodeToString(node)); }
+        YAML::Node encodeNode(true_type) { return ToNode<T>()(*m_val.ref()); }
+        YAML::Node encodeNode(false_type) { return ConfigVarBase::toNode(); }
+        void encodeBinary(string &out, true_type)
+        {
+            out.clear();
+            ToBinary<T>()(*m_val.ref(), out);
+        }
+        void encodeBinary(string &out, false_type) { ConfigVarBase::toBinary(out); }
+        // 解码失败返回空
+        ConstPtr decodeBinary(const char *data, size_t len, true_type)
+        {
+            BinaryReader in(data, len);
+            T val;
+            if (!FromBinary<T>()(in, val) || !in.eof())
+            {
+                return nullptr;
+            }
+            return make_shared<const T>(std::move(val));
+        }
+        ConstPtr decodeBinary(const char *data, size_t len, false_type)
+        {
+            return make_shared<const T>(FromStr()(string(data, len)));
+        }
+
+        // publish时才取旧值，prepare之后别人改过也能正确通知
+        class ValueChange : public Change
+        {
+        public:
+            ValueChange(ConfigVar *var, ConstPtr val) : m_var(var), m_val(val) {}
+            void publish() override
+            {
+                lock_guard<mutex> lock(m_var->m_writeMutex);
+                m_old = m_var->m_val.get();
+                m_var->m_val.store(m_val);
+            }
+            void notify() override
+            {
+                if (m_old && !(*m_old == *m_val))
+                {
+                    m_var->notify(*m_old, *m_val);
+                }
+            }
+
+        private:
+            ConfigVar *m_var;
+            ConstPtr m_val;
+            ConstPtr m_old;
+        };
+
+        void notify(const T &old_val, const T &new_val)
+        {
+            // 持有这一版回调集合，不占hazard槽，回调可以任意嵌套
+            auto cbs = m_cbs.get();
+            for (auto &i : *cbs)
+            {
+                i.second(old_val, new_val);
+            }
+        }
+
+    private:
+        Snapshot<T> m_val;
+        mutex m_writeMutex; // 只在取旧值和发布新值时持有，不包括回调
 
         // 变更回调函数，根据key查找删除回调函数，key要求唯一，一般可以用hash
-        map<uint64_t, on_change_cb> m_cbs;
+        Snapshot<map<uint64_t, on_change_cb>> m_cbs;
     };
 
     class Config
@@ -350,13 +1056,14 @@ namespace jyl
         static typename ConfigVar<T>::ptr Lookup(const string &name, const T &default_val,
                                                  const string &description = "")
         {
-            auto it = s_datas.find(name);
-            if (it != s_datas.end())
+            auto it = GetDatas().find(name);
+            if (it != GetDatas().end())
             {
                 auto tmp = dynamic_pointer_cast<ConfigVar<T>>(it->second);
                 if (tmp)
                 {
                     JYL_LOG_INFO(JYL_LOG_ROOT()) << "Lookup name=" << name << "exsits";
+                    return tmp;
                 }
                 else
                 {
@@ -377,23 +1084,15 @@ namespace jyl
                 // throw invalid_argument(name);
             }
             typename ConfigVar<T>::ptr v(new ConfigVar<T>(name, default_val, description));
-            if (s_datas.find(name) == s_datas.end())
-            {
-                // 没找到就插入
-                s_datas.insert(make_pair(name, v));
-            }
-            else
-            {
-                s_datas[name] = v;
-            }
+            Register(name, v);
             return v;
         }
 
         template <class T>
         static typename ConfigVar<T>::ptr Lookup(const string &name)
         {
-            auto it = s_datas.find(name);
-            if (it == s_datas.end())
+            auto it = GetDatas().find(name);
+            if (it == GetDatas().end())
             {
                 return nullptr;
             }
@@ -401,9 +1100,92 @@ namespace jyl
         }
         // static void LoadFromYaml(const YAML::Node &node);
         static ConfigVarBase::ptr lookupBase(const string &name);
+        // 按名字顺序遍历prefix本身以及prefix.xxx下的所有配置项，prefix为空时遍历全部
+        static void Visit(const string &prefix, function<void(const ConfigVarBase::ptr &)> cb);
+        // yaml里有对应配置项的节点，按文档顺序，父节点在子节点前
+        static void Collect(const YAML::Node &node, vector<pair<ConfigVarBase::ptr, YAML::Node>> &output);
+
+        /*
+            配置快照：把所有配置项的当前值(名字、类型、二进制值)写进一个文件，启动时直接mmap应用，不用解析yaml。
+            sources是这些值来自的yaml文件，保存时记下它们的校验和；加载时文件内容变了、
+            快照损坏或版本不对都返回false，调用方应改为加载yaml(之后可以再保存一次快照)。
+            快照里类型对不上或已经不存在的配置项跳过
+        */
+        static bool SaveSnapshot(const string &path, const vector<string> &sources = vector<string>());
+        static bool LoadSnapshot(const string &path, const vector<string> &sources = vector<string>());
+
+    private:
+        // 配置名按"."分段的前缀树，加载时只走有配置项的分支
+        struct TrieNode
+        {
+            ConfigVarBase::ptr var;
+            map<string, unique_ptr<TrieNode>> children;
+        };
+
+        static void Register(const string &name, ConfigVarBase::ptr var);
+        // 名字对应的树节点，不区分大小写，没有返回nullptr
+        static const TrieNode *FindNode(const string &name);
+        static void CollectNode(const TrieNode &trie, const YAML::Node &node,
+                                vector<pair<ConfigVarBase::ptr, YAML::Node>> &output);
+        static void VisitNode(const TrieNode &trie, const function<void(const ConfigVarBase::ptr &)> &cb);
+
+        // 保存的配置信息，函数内的静态变量保证其它文件的静态变量初始化时已经构造好
+        static ConfigVarMap &GetDatas()
+        {
+            static ConfigVarMap s_datas;
+            return s_datas;
+        }
+        static TrieNode &GetTrie()
+        {
+            static TrieNode s_trie;
+            return s_trie;
+        }
+    };
+
+    /*
+        配置文件热加载：用inotify监视yaml文件所在的目录(编辑器常常写临时文件再改名)，
+        文件写完或被替换后只重新加载这个文件，和上次加载的内容逐个配置项比较，子树变了的才更新。
+        一次加载先解析出所有变化的配置项，全部成功才统一生效，之后再依次调用回调，
+        回调里读到的其它配置项已经是这次加载后的值；有一项解析失败整个文件这次不生效。
+        文件里删掉的配置项保持原来的值。进程退出时不析构
+    */
+    class ConfigWatcher
+    {
+    public:
+        static ConfigWatcher *GetInstance();
+
+        // 立即加载一次并开始监视；文件暂时不存在或有错也会监视，返回是否加载成功
+        bool addFile(const string &path);
+        void delFile(const string &path);
+        // 处理已经发生的改动，timeout_ms为-1时一直等到有事件；返回这次更新了多少配置项。
+        // 多个线程同时调用时串行处理；回调在内部锁外执行，回调里可以addFile/delFile
+        int check(int timeout_ms = 0);
+        // 启动后台线程自动check，回调在这个线程里执行
+        void start();
+        // 可以放进自己的事件循环，可读时调用check()
+        int getFd() const { return m_fd; }
+
+    private:
+        struct File
+        {
+            string path;
+            string content;                // 上次成功加载的文件内容
+            map<string, YAML::Node> nodes; // 上次加载时每个配置项对应的节点
+        };
+
+        ConfigWatcher();
+        // 解析文件，把要做的改动追加到output，返回更新的配置项数，失败返回-1
+        int reloadLocked(File &file, vector<ConfigVarBase::Change::ptr> &output);
+        // 让改动生效并通知，不持有m_mutex
+        static void Apply(const vector<ConfigVarBase::Change::ptr> &changes);
 
     private:
-        static ConfigVarMap s_datas; // 保存的配置信息
+        recursive_mutex m_checkMutex; // 串行化读事件和生效，回调里可以再addFile或check
+        mutex m_mutex;                // m_dirs和m_files
+        int m_fd;
+        map<int, string> m_dirs;     // watch描述符 -> 目录
+        map<string, File> m_files;   // 目录/文件名 -> 文件
+        atomic<bool> m_started{false};
     };
 
 }
\ No newline at end of file
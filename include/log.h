@@ -9,18 +9,32 @@
 #include <sstream>
 #include <vector>
 #include <map>
+#include <deque>
 #include <stdarg.h>
-#include "../include/config.h"
+#include <string.h>
+#include <type_traits>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <signal.h>
 #include "../include/singleton.h"
 #include "../include/util.h"
+#include "../include/snapshot.h"
 
 using namespace std;
 
+// 编译期的最低日志级别(数值同jyl::LogLevel，DEBUG=1 ... FATAL=5)，
+// 低于它的日志语句连同参数的求值一起被编译器去掉，比如release版本用-DJYL_LOG_ACTIVE_LEVEL=3
+#ifndef JYL_LOG_ACTIVE_LEVEL
+#define JYL_LOG_ACTIVE_LEVEL 1
+#endif
+
 #define JYL_LOG_LEVEL(logger, level)                                                                  \
-    if (logger->getLevel() <= level)                                                                  \
-    jyl::LogEventWrap(jyl::LogEvent::ptr(new jyl::LogEvent(logger, level,                             \
-                                                           __FILE__, __LINE__, 0, jyl::getThreadID(), \
-                                                           jyl::getFiberID(), time(0))))              \
+    if (level >= JYL_LOG_ACTIVE_LEVEL && logger->getLevel() <= level)                                 \
+    jyl::LogEventWrap(jyl::LogEvent::Acquire(logger, level,                                           \
+                                             __FILE__, __LINE__, jyl::getElapsedMS(), jyl::getThreadID(),               \
+                                             jyl::getFiberID(), jyl::getRealTimeUS()))                \
         .getSS()
 
 #define JYL_LOG_DEBUG(logger) JYL_LOG_LEVEL(logger, jyl::LogLevel::DEBUG)
@@ -29,23 +43,62 @@ using namespace std;
 #define JYL_LOG_ERROR(logger) JYL_LOG_LEVEL(logger, jyl::LogLevel::ERROR)
 #define JYL_LOG_FATAL(logger) JYL_LOG_LEVEL(logger, jyl::LogLevel::FATAL)
 
-#define JYL_LOG_FMT_LEVEL(logger, level, fmt, ...)                                                               \
-    if (logger->getLevel() <= level)                                                                             \
-    jyl::LogEventWrap(jyl::LogEvent::ptr(new jyl::LogEvent(logger, level,                                        \
-                                                           __FILE__, __LINE__, 0, jyl::GetThreadId(),            \
-                                                           jyl::GetFiberId(), time(0), jyl::Thread::GetName()))) \
-        .getEvent()                                                                                              \
-        ->format(fmt, __VA_ARGS__)
+// {}风格的格式化，fmt必须是字符串字面量，{}的个数和参数个数在编译期检查，{{和}}输出花括号
+#define JYL_LOG_FMT_LEVEL(logger, level, fmt, ...)                                                    \
+    do                                                                                                \
+    {                                                                                                 \
+        static_assert(jyl::detail::CountPlaceholders(fmt) ==                                          \
+                          decltype(jyl::detail::MakeArgCount(__VA_ARGS__))::value,                    \
+                      "placeholders and arguments do not match: " fmt);                              \
+        if (level >= JYL_LOG_ACTIVE_LEVEL && logger->getLevel() <= level)                             \
+            jyl::FormatTo(jyl::LogEventWrap(jyl::LogEvent::Acquire(logger, level,                     \
+                                                                   __FILE__, __LINE__, jyl::getElapsedMS(),             \
+                                                                   jyl::getThreadID(),                \
+                                                                   jyl::getFiberID(),                 \
+                                                                   jyl::getRealTimeUS()))             \
+                              .getSS(),                                                               \
+                          fmt, ##__VA_ARGS__);                                                        \
+    } while (0)
+
+#define JYL_LOG_FMT_DEBUG(logger, fmt, ...) JYL_LOG_FMT_LEVEL(logger, jyl::LogLevel::DEBUG, fmt, ##__VA_ARGS__)
+#define JYL_LOG_FMT_INFO(logger, fmt, ...) JYL_LOG_FMT_LEVEL(logger, jyl::LogLevel::INFO, fmt, ##__VA_ARGS__)
+#define JYL_LOG_FMT_WARN(logger, fmt, ...) JYL_LOG_FMT_LEVEL(logger, jyl::LogLevel::WARN, fmt, ##__VA_ARGS__)
+#define JYL_LOG_FMT_ERROR(logger, fmt, ...) JYL_LOG_FMT_LEVEL(logger, jyl::LogLevel::ERROR, fmt, ##__VA_ARGS__)
+#define JYL_LOG_FMT_FATAL(logger, fmt, ...) JYL_LOG_FMT_LEVEL(logger, jyl::LogLevel::FATAL, fmt, ##__VA_ARGS__)
+
+// 按调用点采样，每个调用点有自己的静态计数，被跳过的调用不创建LogEvent。
+// 下一条输出的日志前面带上期间跳过的条数，比如 JYL_LOG_EVERY_N(logger, jyl::LogLevel::INFO, 100) << "recv " << n;
+#define JYL_LOG_SAMPLED(logger, level, sample)                                                        \
+    if (jyl::LogSample jyl_log_sample = level >= JYL_LOG_ACTIVE_LEVEL && logger->getLevel() <= level   \
+                                            ? JYL_LOG_SAMPLER().sample                                \
+                                            : jyl::LogSample())                                       \
+    jyl_log_sample.note(jyl::LogEventWrap(jyl::LogEvent::Acquire(logger, level,                       \
+                                                                 __FILE__, __LINE__, jyl::getElapsedMS(),               \
+                                                                 jyl::getThreadID(),                  \
+                                                                 jyl::getFiberID(),                   \
+                                                                 jyl::getRealTimeUS()))               \
+                            .getSS())
+
+// 调用点自己的采样状态：每个lambda是不同的类型，里面的静态变量各有一份
+#define JYL_LOG_SAMPLER() ([]() -> jyl::LogSampler & { static jyl::LogSampler s_sampler; return s_sampler; }())
+
+// 每n次输出一次
+#define JYL_LOG_EVERY_N(logger, level, n) JYL_LOG_SAMPLED(logger, level, everyN(n))
+// 只输出前n次
+#define JYL_LOG_FIRST_N(logger, level, n) JYL_LOG_SAMPLED(logger, level, firstN(n))
+// 每ms毫秒最多输出一次
+#define JYL_LOG_EVERY_MS(logger, level, ms) JYL_LOG_SAMPLED(logger, level, everyMS(ms))
 
 #define JYL_LOG_ROOT() jyl::loggerManager::getInstance()->getRoot()
 
-#define JYL_LOG_NAME(name) jyl::LoggerManager::getInstance()->getLogger(name)
+#define JYL_LOG_NAME(name) jyl::loggerManager::getInstance()->getLogger(name)
 
 namespace jyl
 {
     class Logger;
     class LogEvent;
     class LoggerManager;
+    struct BinLogSite;
     class LogLevel
     {
     public:
@@ -56,37 +109,321 @@ namespace jyl
             INFO,
             WARN,
             ERROR,
-            FATAL
+            FATAL,
+            OFF = 100 // 关闭
         };
         static const char *toString(LogLevel::Level level);
+        // 不区分大小写，不认识的返回UNKNOWN
+        static LogLevel::Level FromString(const string &str);
+    };
+    // 结构化字段，值保持原来的类型，key和字符串值存在同一块缓存里，事件复用时不再分配内存
+    class LogFields
+    {
+    public:
+        enum Type : uint8_t
+        {
+            INT = 0,
+            UINT,
+            DOUBLE,
+            BOOL,
+            STRING
+        };
+        struct Field
+        {
+            Type type;
+            uint32_t keyOffset; // key在m_strings里的位置
+            uint32_t keyLen;
+            union
+            {
+                int64_t i;
+                uint64_t u;
+                double d;
+                bool b;
+                struct
+                {
+                    uint32_t offset;
+                    uint32_t len;
+                } s; // 字符串值在m_strings里的位置
+            };
+        };
+
+        template <class T>
+        typename enable_if<is_integral<T>::value && is_signed<T>::value && !is_same<T, char>::value>::type
+        add(const char *key, T v) { push(key, INT).i = v; }
+        template <class T>
+        typename enable_if<is_integral<T>::value && !is_signed<T>::value && !is_same<T, bool>::value && !is_same<T, char>::value>::type
+        add(const char *key, T v) { push(key, UINT).u = v; }
+        template <class T>
+        typename enable_if<is_floating_point<T>::value>::type
+        add(const char *key, T v) { push(key, DOUBLE).d = v; }
+        void add(const char *key, bool v) { push(key, BOOL).b = v; }
+        void add(const char *key, char v) { addString(key, &v, 1); }
+        void add(const char *key, const char *v) { addString(key, v ? v : "", v ? strlen(v) : 0); }
+        void add(const char *key, char *v) { add(key, (const char *)v); }
+        void add(const char *key, const string &v) { addString(key, v.data(), v.size()); }
+        // 其它类型用iostream转成字符串
+        template <class T>
+        typename enable_if<!is_arithmetic<T>::value>::type
+        add(const char *key, const T &v)
+        {
+            stringstream ss;
+            ss << v;
+            add(key, ss.str());
+        }
+
+        size_t size() const { return m_fields.size(); }
+        bool empty() const { return m_fields.empty(); }
+        const Field &operator[](size_t i) const { return m_fields[i]; }
+        const char *key(const Field &f) const { return m_strings.data() + f.keyOffset; }
+        const char *str(const Field &f) const { return m_strings.data() + f.s.offset; }
+        void clear()
+        {
+            m_fields.clear();
+            m_strings.clear();
+        }
+
+    private:
+        Field &push(const char *key, Type type)
+        {
+            m_fields.emplace_back();
+            Field &f = m_fields.back();
+            f.type = type;
+            f.keyOffset = m_strings.size();
+            f.keyLen = strlen(key);
+            m_strings.append(key, f.keyLen);
+            return f;
+        }
+        void addString(const char *key, const char *data, size_t len)
+        {
+            Field &f = push(key, STRING);
+            f.s.offset = m_strings.size();
+            f.s.len = len;
+            m_strings.append(data, len);
+        }
+
+    private:
+        vector<Field> m_fields;
+        string m_strings;
     };
+
+    // 日志内容的输出流，直接追加到string里，不经过iostream和locale
+    class LogStream
+    {
+    public:
+        // 附加一个结构化字段，没有关联事件时忽略
+        template <class T>
+        LogStream &kv(const char *key, const T &v)
+        {
+            if (m_fields)
+            {
+                m_fields->add(key, v);
+            }
+            return *this;
+        }
+        void setFields(LogFields *fields) { m_fields = fields; }
+
+        LogStream &operator<<(const char *v)
+        {
+            if (v)
+            {
+                m_buf.append(v);
+            }
+            return *this;
+        }
+        LogStream &operator<<(char *v) { return *this << (const char *)v; }
+        LogStream &operator<<(const string &v)
+        {
+            m_buf.append(v);
+            return *this;
+        }
+        LogStream &operator<<(char v)
+        {
+            m_buf.append(1, v);
+            return *this;
+        }
+        LogStream &operator<<(bool v)
+        {
+            m_buf.append(1, v ? '1' : '0');
+            return *this;
+        }
+        LogStream &operator<<(short v) { return appendInt(v); }
+        LogStream &operator<<(unsigned short v) { return appendUInt(v); }
+        LogStream &operator<<(int v) { return appendInt(v); }
+        LogStream &operator<<(unsigned int v) { return appendUInt(v); }
+        LogStream &operator<<(long v) { return appendInt(v); }
+        LogStream &operator<<(unsigned long v) { return appendUInt(v); }
+        LogStream &operator<<(long long v) { return appendInt(v); }
+        LogStream &operator<<(unsigned long long v) { return appendUInt(v); }
+        LogStream &operator<<(float v) { return appendDouble(v); }
+        LogStream &operator<<(double v) { return appendDouble(v); }
+        LogStream &operator<<(long double v) { return appendDouble(v); }
+        LogStream &operator<<(const void *v);
+        // endl等操纵符，只支持换行
+        LogStream &operator<<(ostream &(*pf)(ostream &));
+        // 其它类型用iostream的operator<<，比较慢
+        template <class T>
+        LogStream &operator<<(const T &v)
+        {
+            stringstream ss;
+            ss << v;
+            m_buf.append(ss.str());
+            return *this;
+        }
+
+        LogStream &append(const char *data, size_t len)
+        {
+            m_buf.append(data, len);
+            return *this;
+        }
+        // printf风格，直接写到缓存里
+        LogStream &vappend(const char *fmt, va_list al);
+        const string &str() const { return m_buf; }
+        // 清空内容，保留已分配的内存
+        void clear() { m_buf.clear(); }
+
+    private:
+        LogStream &appendInt(long long v);
+        LogStream &appendUInt(unsigned long long v);
+        LogStream &appendDouble(double v);
+
+    private:
+        string m_buf;
+        LogFields *m_fields = nullptr; // 所属事件的字段
+    };
+
+    namespace detail
+    {
+        // 格式串里{}的个数，有不成对的花括号返回-1
+        constexpr int CountPlaceholders(const char *fmt)
+        {
+            int n = 0;
+            for (; *fmt; ++fmt)
+            {
+                if (*fmt == '{')
+                {
+                    if (fmt[1] == '}')
+                    {
+                        ++n;
+                    }
+                    else if (fmt[1] != '{')
+                    {
+                        return -1;
+                    }
+                    ++fmt;
+                }
+                else if (*fmt == '}')
+                {
+                    if (fmt[1] != '}')
+                    {
+                        return -1;
+                    }
+                    ++fmt;
+                }
+            }
+            return n;
+        }
+
+        template <class... Args>
+        struct ArgCount
+        {
+            static constexpr int value = sizeof...(Args);
+        };
+        // 只在decltype里用，参数不会被求值
+        template <class... Args>
+        ArgCount<Args...> MakeArgCount(const Args &...);
+
+        // 输出fmt到下一个{}之前的部分，返回{}之后的位置，没有{}返回nullptr
+        inline const char *AppendUntilPlaceholder(LogStream &os, const char *fmt)
+        {
+            const char *p = fmt;
+            while (*p)
+            {
+                if ((*p == '{' && p[1] == '{') || (*p == '}' && p[1] == '}'))
+                {
+                    os.append(fmt, p + 1 - fmt);
+                    p += 2;
+                    fmt = p;
+                }
+                else if (*p == '{' && p[1] == '}')
+                {
+                    os.append(fmt, p - fmt);
+                    return p + 2;
+                }
+                else
+                {
+                    ++p;
+                }
+            }
+            os.append(fmt, p - fmt);
+            return nullptr;
+        }
+    }
+
+    inline void FormatTo(LogStream &os, const char *fmt)
+    {
+        detail::AppendUntilPlaceholder(os, fmt);
+    }
+
+    // 按fmt里的{}依次把参数写到os，参数类型要支持LogStream的operator<<
+    template <class T, class... Args>
+    void FormatTo(LogStream &os, const char *fmt, const T &v, const Args &...args)
+    {
+        const char *next = detail::AppendUntilPlaceholder(os, fmt);
+        if (!next)
+        {
+            return;
+        }
+        os << v;
+        FormatTo(os, next, args...);
+    }
+
     class LogEvent
     {
     public:
-        LogEvent(shared_ptr<Logger> logger, LogLevel::Level level, const char *file, int32_t m_line, uint32_t elapse, uint32_t thread_id, uint32_t fiber_id, uint32_t time);
+        LogEvent(shared_ptr<Logger> logger, LogLevel::Level level, const char *file, int32_t m_line, uint32_t elapse, uint32_t thread_id, uint32_t fiber_id, uint64_t time_us);
         ~LogEvent();
         typedef shared_ptr<LogEvent> ptr;
+        // 从线程的事件池里取一个事件，没有空闲的才分配
+        static LogEvent::ptr Acquire(shared_ptr<Logger> logger, LogLevel::Level level, const char *file, int32_t line, uint32_t elapse, uint32_t thread_id, uint32_t fiber_id, uint64_t time_us);
+        // 重新设置各字段并清空内容，用于复用
+        void reset(shared_ptr<Logger> logger, LogLevel::Level level, const char *file, int32_t line, uint32_t elapse, uint32_t thread_id, uint32_t fiber_id, uint64_t time_us);
         const char *getFile() const { return m_file; }
         int32_t getLine() const { return m_line; }
         uint32_t getThreadID() const { return m_threadID; }
+        // 创建事件的线程名
+        const char *getThreadName() const { return m_threadName; }
+        void setThreadName(const char *name);
         uint32_t getFiberID() const { return m_fiberID; }
         uint32_t getElapsed() const { return m_elapsed; }
-        uint64_t getTime() const { return m_time; }
-        string getContent() const { return m_ss.str(); }
-        stringstream &getSS() { return m_ss; }
+        // 秒级时间戳
+        uint64_t getTime() const { return m_time / 1000000; }
+        // 微秒级时间戳
+        uint64_t getTimeUS() const { return m_time; }
+        const string &getContent() const { return m_ss.str(); }
+        // 结构化字段，通过getSS().kv()添加
+        const LogFields &getFields() const { return m_fields; }
+        LogStream &getSS() { return m_ss; }
         shared_ptr<Logger> getLogger() const { return m_logger; }
         LogLevel::Level getLevel() const { return m_level; }
         void format(const char *fmt, ...);
         void format(const char *fmt, va_list al);
+        // 复制other的全部内容，保留已分配的内存
+        void assign(const LogEvent &other);
+
+    private:
+        LogEvent(const LogEvent &) = delete;
+        LogEvent &operator=(const LogEvent &) = delete;
 
     private:
         const char *m_file = nullptr; // 文件名
         int32_t m_line = 0;           // 行号
         uint32_t m_threadID = 0;      // 线程id
+        char m_threadName[16];        // 线程名
         uint32_t m_fiberID = 0;       // 协程id
-        uint32_t m_elapsed;           // 程序启动了多少时间
-        uint64_t m_time;              // 时间戳
-        stringstream m_ss;
+        uint32_t m_elapsed;           // 程序启动后的毫秒数
+        uint64_t m_time;              // 时间戳(微秒)
+        LogStream m_ss;
+        LogFields m_fields; // m_ss里有指向它的指针，事件不能复制
         shared_ptr<Logger> m_logger;
         LogLevel::Level m_level;
     };
@@ -96,38 +433,153 @@ namespace jyl
     public:
         LogEventWrap(LogEvent::ptr event);
         ~LogEventWrap();
-        stringstream &getSS();
+        LogStream &getSS();
         LogEvent::ptr getEvent() const { return m_event; }
 
     private:
         LogEvent::ptr m_event;
     };
 
-    // 格式器
+    // 采样的结果，为true时输出
+    struct LogSample
+    {
+        LogSample(bool ok = false, uint64_t suppressed = 0) : ok(ok), suppressed(suppressed) {}
+        explicit operator bool() const { return ok; }
+        // 有跳过的日志时先写一段说明
+        LogStream &note(LogStream &os) const;
+
+        bool ok;
+        uint64_t suppressed; // 上次输出后跳过的条数
+    };
+
+    // 调用点的采样状态，静态对象，常量初始化
+    class LogSampler
+    {
+    public:
+        LogSample everyN(uint64_t n)
+        {
+            uint64_t c = m_count.fetch_add(1, memory_order_relaxed);
+            if (n <= 1 || c % n == 0)
+            {
+                return LogSample(true, c > 0 && n > 1 ? n - 1 : 0);
+            }
+            return LogSample();
+        }
+        LogSample firstN(uint64_t n)
+        {
+            // 超过n次以后只有一次读
+            if (m_count.load(memory_order_relaxed) >= n)
+            {
+                return LogSample();
+            }
+            return LogSample(m_count.fetch_add(1, memory_order_relaxed) < n);
+        }
+        LogSample everyMS(uint64_t ms)
+        {
+            uint64_t now = getCurrentMS();
+            uint64_t next = m_next.load(memory_order_relaxed);
+            if (now < next || !m_next.compare_exchange_strong(next, now + ms, memory_order_relaxed))
+            {
+                m_count.fetch_add(1, memory_order_relaxed);
+                return LogSample();
+            }
+            return LogSample(true, m_count.exchange(0, memory_order_relaxed));
+        }
+
+    private:
+        atomic<uint64_t> m_count{0}; // everyN/firstN: 调用次数; everyMS: 跳过的次数
+        atomic<uint64_t> m_next{0};  // everyMS: 下次允许输出的时间
+    };
+
+    // 格式器，init把pattern编译成一组指令，format时顺序执行，直接追加到输出缓存
     class LogFormatter
     {
     public:
         typedef shared_ptr<LogFormatter> ptr;
         string format(shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event);
+        // 把格式化结果追加到out后面
+        virtual void format(string &out, Logger *logger, LogLevel::Level level, const LogEvent &event) const;
         LogFormatter(const string &pattern);
+        virtual ~LogFormatter() {}
 
-    public:
-        class FormatItem
-        {
-        public:
-            // virtual ~FormatItem() {}
-            FormatItem(const string &fmt = "") {}
-            virtual void format(ostream &os, shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event) = 0;
-            typedef shared_ptr<FormatItem> ptr;
-        };
         void init();
         bool isError() const { return m_error; }
+        const string &getPattern() const { return m_pattern; }
+
+    private:
+        enum OpCode : uint8_t
+        {
+            OP_LITERAL = 0, // 字面量，连续的字面量、%T、%n合并成一条
+            OP_MESSAGE,     // %m
+            OP_LEVEL,       // %p
+            OP_ELAPSED,     // %r 程序启动后的毫秒数
+            OP_NAME,        // %c
+            OP_THREAD_ID,   // %t
+            OP_THREAD_NAME, // %N
+            OP_FIBER_ID,    // %F
+            OP_DATETIME,    // %d，参数是strftime的格式
+            OP_FILE,        // %f
+            OP_LINE,        // %l
+            OP_MSEC,        // %ms 毫秒部分，3位
+            OP_USEC,        // %us 微秒部分，6位
+            OP_FIELDS       // %k 结构化字段，key=value用空格分隔
+        };
+        struct Op
+        {
+            OpCode code;
+            uint32_t offset; // 参数在m_strings里的位置
+            uint32_t len;    // 参数长度，OP_DATETIME是m_dates的下标
+        };
+        // %d的格式，按秒数的变化情况决定怎么复用线程缓存
+        enum DateMode : uint8_t
+        {
+            DATE_MINUTE = 0, // 格式里没有秒，同一分钟结果不变
+            DATE_PATCH,      // 只有一个%S，同一分钟内只改写秒数的两位
+            DATE_SECOND      // 其它情况，同一秒结果不变
+        };
+        struct DateFormat
+        {
+            uint32_t id;           // 全局唯一，用于查找线程缓存
+            DateMode mode;
+            uint32_t prefixOffset; // DATE_PATCH时%S之前的部分，用于计算秒数的位置
+        };
+        void addOp(OpCode code, const string &arg = "");
+        void addDateOp(const string &fmt);
+        void formatDate(string &out, const Op &op, uint64_t time) const;
 
     private:
         string m_pattern;
-        vector<FormatItem::ptr> m_items;
+        vector<Op> m_ops;
+        string m_strings; // 所有指令的参数
+        vector<DateFormat> m_dates;
         bool m_error = false;
     };
+
+    // JSON格式，每条日志一个对象，结构化字段保持原来的类型，直接转义写进输出缓存：
+    // {"time":"...","level":"INFO","logger":"root","thread":1,"thread_name":"main","fiber":0,
+    //  "file":"a.cpp","line":10,"msg":"...","key":value...}
+    class JsonLogFormatter : public LogFormatter
+    {
+    public:
+        typedef shared_ptr<JsonLogFormatter> ptr;
+        // time_pattern: time字段的格式，语法同LogFormatter
+        JsonLogFormatter(const string &time_pattern = "%d{%Y-%m-%d %H:%M:%S}.%us");
+        using LogFormatter::format;
+        void format(string &out, Logger *logger, LogLevel::Level level, const LogEvent &event) const override;
+    };
+    namespace detail
+    {
+        // 一次分发的范围：范围内格式器和级别相同的appender共用一次格式化结果(见LogAppender::formatEvent)
+        class FormatMemoScope
+        {
+        public:
+            FormatMemoScope();
+            ~FormatMemoScope();
+        };
+        // 当前线程退出时调用cb，线程已经在退出时不注册，返回false
+        bool AtThreadExit(function<void()> cb);
+    }
+
     // 日志输出地
     class LogAppender
     {
@@ -137,12 +589,36 @@ namespace jyl
         typedef shared_ptr<LogAppender> ptr;
 
         virtual void log(shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event) = 0;
-        void setFormatter(LogFormatter::ptr formatter) { m_formatter = formatter; }
-        LogFormatter::ptr getFormatter() { return m_formatter; }
+        // 把缓存中的内容刷到目标上，默认无缓存
+        virtual void flush() {}
+        // 二进制日志(见binlog.h)，直接记录了返回true。默认返回false，
+        // 由Logger还原成文本事件交给log，同一条日志的多个appender共用一次还原
+        virtual bool logBinary(Logger *logger, const BinLogSite &site, const char *args, size_t len,
+                               uint64_t time_us, uint32_t elapse, uint32_t thread_id, uint32_t fiber_id);
+        // 格式器和级别可以在其它线程写日志时修改
+        void setFormatter(LogFormatter::ptr formatter) { m_formatter.store(make_shared<const LogFormatter::ptr>(formatter)); }
+        LogFormatter::ptr getFormatter() const
+        {
+            return m_formatter.read([](const LogFormatter::ptr &f)
+                                    { return f; });
+        }
+        bool hasFormatter() const
+        {
+            return m_formatter.read([](const LogFormatter::ptr &f)
+                                    { return (bool)f; });
+        }
+        // 低于该级别的事件在格式化之前丢掉
+        void setLevel(LogLevel::Level level) { m_level.store(level, memory_order_relaxed); }
+        LogLevel::Level getLevel() const { return m_level.load(memory_order_relaxed); }
+
+    protected:
+        // 用m_formatter格式化，同一次Logger::log分发里格式器相同的appender共用一次结果。
+        // 返回的内容在本线程下一次格式化之前有效
+        const string &formatEvent(Logger *logger, LogLevel::Level level, const LogEvent &event);
 
     protected:
-        LogLevel::Level m_level = LogLevel::DEBUG;
-        LogFormatter::ptr m_formatter;
+        atomic<LogLevel::Level> m_level{LogLevel::DEBUG};
+        Snapshot<LogFormatter::ptr> m_formatter;
     };
 
     // 日志器
@@ -154,6 +630,9 @@ namespace jyl
         Logger(const string &name = "root");
         typedef shared_ptr<Logger> ptr;
         void log(LogLevel::Level level, LogEvent::ptr event);
+        // 二进制日志，args是编码后的参数。
+        // 各线程缓存appender集合，删掉的appender要等各线程下一次写二进制日志或者线程退出才释放
+        void logBinary(const BinLogSite &site, const char *args, size_t len, uint64_t time_us);
 
         void debug(LogEvent::ptr event);
         void info(LogEvent::ptr event);
@@ -163,53 +642,451 @@ namespace jyl
 
         void addAppender(LogAppender::ptr appender);
         void delAppender(LogAppender::ptr appender);
-        LogLevel::Level getLevel() const { return m_level; }
-        string getName() const { return m_name; }
-        void setLevel(LogLevel::Level level) { m_level = level; }
+        void clearAppenders();
+        LogLevel::Level getLevel() const { return m_level.load(memory_order_relaxed); }
+        const string &getName() const { return m_name; }
+        // 进程内唯一，不复用
+        uint32_t getId() const { return m_id; }
+        void setLevel(LogLevel::Level level) { m_level.store(level, memory_order_relaxed); }
+        // 没有自己格式器的appender跟着换
+        void setFormatter(LogFormatter::ptr formatter);
+        bool setFormatter(const string &pattern);
+        LogFormatter::ptr getFormatter() const
+        {
+            return m_formatter.read([](const LogFormatter::ptr &f)
+                                    { return f; });
+        }
+
+        // 限流(GCRA令牌桶)：平均每秒rate条，最多连续burst条，rate为0不限。
+        // ERROR及以上不受限制，被丢弃的条数在下一条输出前汇总成一条WARN。
+        // 只对有自己appender的logger生效：没有appender的logger把日志交给root，由root的限流计数
+        void setRateLimit(uint32_t rate, uint32_t burst);
+        uint64_t getRateDropped() const { return m_rateDroppedTotal.load(memory_order_relaxed); }
+
+    private:
+        bool rateAllow(LogLevel::Level level);
+        // 有被限流丢弃的日志时生成一条汇总的WARN
+        LogEvent::ptr takeRateNote(const char *file, int32_t line, uint32_t elapse, uint32_t thread_id,
+                                   uint32_t fiber_id, uint64_t time_us);
+        // 交给自己的appender，没有appender返回false
+        bool dispatch(LogLevel::Level level, const LogEvent::ptr &event);
 
     private:
         string m_name;                         // 日志名称
-        LogLevel::Level m_level;               // 日志级别
-        list<LogAppender::ptr> m_appenderList; // appender集合
-        LogFormatter::ptr m_formatter;         // 日志格式化器
+        uint32_t m_id;
+        atomic<LogLevel::Level> m_level;       // 日志级别
+        Snapshot<vector<LogAppender::ptr>> m_appenders; // appender集合，写时复制
+        atomic<uint64_t> m_appendersVersion;   // appender集合的版本，所有logger之间唯一
+        Snapshot<LogFormatter::ptr> m_formatter; // 日志格式化器
         Logger::ptr m_root;
+        atomic<uint64_t> m_rateInterval{0};    // 每条的间隔(ns)，0表示不限流
+        atomic<uint64_t> m_rateTolerance{0};   // 允许超前的时间(ns)
+        atomic<uint64_t> m_rateTat{0};         // 理论上下一条到达的时间(ns)
+        atomic<uint64_t> m_rateDropped{0};     // 还没汇总的丢弃条数
+        atomic<uint64_t> m_rateDroppedTotal{0};
     };
 
-    // 输出到控制台
+    /*
+        输出到控制台，直接write(2)到fd 1，不经过cout。
+        终端上逐行输出；重定向到文件或管道时攒成一批再写，最长延迟max_latency毫秒，ERROR及以上立即写出
+    */
     class StdoutLogAppender : public LogAppender
     {
     public:
         typedef shared_ptr<StdoutLogAppender> ptr;
+        // max_latency为0时也逐行输出
+        StdoutLogAppender(uint32_t max_latency = 100, size_t buffer_size = 64 * 1024);
+        ~StdoutLogAppender();
         void log(Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event) override;
+        void flush() override;
+        // ERROR及以上是否写到stderr(fd 2)
+        void setErrorToStderr(bool v) { m_errorToStderr = v; }
+        bool isTTY() const { return m_tty; }
 
     private:
+        void flushLocked();
+
+    private:
+        string m_buffer;          // 待写入的内容
+        size_t m_bufferSize;      // 缓存阈值
+        uint32_t m_maxLatency;    // 最长延迟(ms)
+        uint64_t m_lastFlush = 0;
+        bool m_tty;               // 输出是终端，逐行写
+        bool m_errorToStderr = false;
+        mutex m_mutex;
+    };
+    /*
+        FileLogAppender的索引文件(日志文件名.idx)：文件头"JYLLIDX\0" + u32版本，之后是定长的LogIndexEntry，本机字节序。
+        每写满一块(默认64KB)记一条，查询时先按时间和级别挑出块再读日志文件，见jyl-logq
+    */
+    struct LogIndexEntry
+    {
+        static const uint32_t kAllLevels = 0xFFFFFFFF;
+
+        uint64_t offset;  // 块在日志文件里的起始位置
+        uint32_t length;  // 块的字节数
+        uint32_t count;   // 日志条数，0表示没有记录过的内容(比如开启索引前写的)，时间和级别未知
+        uint64_t minTime; // 最早的时间戳(微秒)
+        uint64_t maxTime; // 最晚的时间戳(微秒)
+        uint32_t levels;  // 出现过的级别，第level位
+        uint32_t reserved;
     };
+
     // 输出到文件
     class FileLogAppender : public LogAppender
     {
     public:
-        FileLogAppender(const string &filename);
         typedef shared_ptr<FileLogAppender> ptr;
+        // 按时间切分文件的周期
+        enum RotatePeriod
+        {
+            NONE = 0,
+            HOURLY,
+            DAILY
+        };
+        // buffer_size: 缓存达到多少字节写一次文件; flush_interval: 最长多少毫秒刷一次
+        FileLogAppender(const string &filename, size_t buffer_size = 1024 * 1024, uint32_t flush_interval = 1000);
+        ~FileLogAppender();
         void log(Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event) override;
-        // 重新打开文件
+        void flush() override;
+        // 重新打开文件，只在显式请求时调用(比如logrotate之后)
         bool reopen();
+        const string &getFilename() const { return m_filename; }
+
+        // 文件超过max_size字节时切分，0表示不按大小切分
+        void setMaxSize(uint64_t max_size) { m_maxSize = max_size; }
+        void setRotatePeriod(RotatePeriod period);
+        // 保留多少个切分出来的文件，0表示全部保留
+        void setMaxFiles(uint32_t max_files) { m_maxFiles = max_files; }
+        // 切分出来的文件是否在后台压缩成.gz
+        void setCompress(bool v) { m_compress = v; }
+        // 每次写文件后是否fdatasync
+        void setFsync(bool v) { m_fsync = v; }
+        // 是否写索引文件，block_size是每条索引覆盖的字节数
+        void setIndex(bool v, uint32_t block_size = 64 * 1024);
+        // 打开、写入、切分文件失败的次数，连续失败只在第一次打印到stderr
+        uint64_t getErrors() const { return m_errors.load(memory_order_relaxed); }
+        // 文件打不开时丢掉的字节数
+        uint64_t getDropped() const { return m_dropped.load(memory_order_relaxed); }
+
+        static const char kIndexMagic[8];
+        static const uint32_t kIndexVersion = 1;
+
+        // 通知所有FileLogAppender在下一次输出前重新打开文件，可以在信号处理函数里调用
+        static void RequestReopen();
+        // 收到sig时重新打开所有日志文件
+        static void InstallReopenSignal(int sig = SIGHUP);
+
+    protected:
+        bool openLocked();
+        bool flushLocked();
+        // 往m_buffer追加内容前后调用，处理重新打开的请求和刷新条件
+        void beforeAppendLocked();
+        void afterAppendLocked(LogLevel::Level level);
+        // 打开了新文件(可能是空文件)，持有m_mutex时调用，缓存里可能还有没写出的内容
+        virtual void onFileOpened() {}
+        // attach为false时先不注册后台刷新，重写了flush的派生类构造完成后调用attachFlusher
+        FileLogAppender(const string &filename, size_t buffer_size, uint32_t flush_interval, bool attach);
+        void attachFlusher();
+        // 停止后台刷新和切分，返回后不会再调用flush，重写了flush的派生类析构时先调用
+        void detachFlusher();
+        // 在后台线程里重命名当前文件并打开新文件，只在换fd时持有m_mutex
+        void rotate();
+        void updatePeriodEnd();
+        // 打开当前日志文件对应的索引，补上没有索引的部分
+        void openIndexLocked();
+        // 把当前块的索引放进缓存，从end开始新的块
+        void closeBlockLocked(uint64_t end);
+        // 日志内容没能全部写出时，去掉超出m_fileSize的块，当前块从第一个不完整的块开始
+        void trimIndexLocked();
+        // 写出缓存的索引，要在对应的日志内容写出之后
+        void writeIndexLocked();
+        // 记录一次失败，errno还是出错时的值
+        void errorLocked(const char *what, const string &name);
+
+    protected:
+        string m_filename;
+        int m_fd = -1;
+        string m_buffer;         // 待写入的内容
+        size_t m_bufferSize;     // 缓存阈值
+        uint32_t m_flushInterval; // 刷新间隔(ms)
+        uint64_t m_lastFlush = 0;
+        uint32_t m_reopenGen;    // 已处理的重新打开请求
+        uint64_t m_fileSize = 0; // 当前文件大小
+        time_t m_openTime = 0;   // 当前文件开始写的时间，用于切分后的文件名
+        uint64_t m_maxSize = 0;
+        RotatePeriod m_period = NONE;
+        time_t m_periodEnd = 0;  // 当前周期结束的时间
+        uint32_t m_maxFiles = 0;
+        bool m_compress = false;
+        bool m_fsync = false;
+        bool m_index = false;
+        uint32_t m_indexBlock = 64 * 1024;
+        int m_indexFd = -1;
+        string m_indexBuffer;    // 待写入的索引，在日志内容写出之后写
+        LogIndexEntry m_block;   // 正在记录的块
+        bool m_rotating = false; // 已经投递了切分任务
+        bool m_failing = false;  // 上一次操作失败了，成功写出之前不再打印
+        atomic<uint64_t> m_errors{0};
+        atomic<uint64_t> m_dropped{0};
+        mutex m_mutex;
+    };
+
+    /*
+        内存映射文件输出地：文件按块预分配后整体映射，写日志的线程用原子偏移抢占位置后直接memcpy，
+        不加锁也没有write系统调用。进程崩溃时已经拷贝进映射的内容还在页缓存里，由内核写回磁盘，
+        文件末尾可能留下预分配的0，正常切分和关闭时会截断到实际长度
+    */
+    class MmapFileLogAppender : public LogAppender
+    {
+    public:
+        typedef shared_ptr<MmapFileLogAppender> ptr;
+        // max_size: 单个文件的最大字节数，也是映射的大小，写满后切分; chunk_size: 每次预分配的大小
+        MmapFileLogAppender(const string &filename, uint64_t max_size = 1ULL << 30, uint64_t chunk_size = 16 << 20);
+        ~MmapFileLogAppender();
+        void log(Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event) override;
+        // 通知内核把映射的脏页写回磁盘，不等待完成
+        void flush() override;
+        bool reopen();
+        const string &getFilename() const { return m_filename; }
+        void setMaxFiles(uint32_t max_files) { m_maxFiles = max_files; }
+        void setCompress(bool v) { m_compress = v; }
+        // 打开、预分配、截断文件失败的次数，连续失败只在第一次打印到stderr
+        uint64_t getErrors() const { return m_errors.load(memory_order_relaxed); }
+        // 文件打不开或预分配失败时丢掉的字节数
+        uint64_t getDropped() const { return m_dropped.load(memory_order_relaxed); }
+
+    private:
+        // 记录一次失败，errno还是出错时的值，持有m_mutex或m_growMutex时调用
+        void errorLocked(const char *what);
+        // 以下都要持有m_mutex
+        // rotate为true时先把当前文件重命名
+        bool openLocked(bool rotate);
+        void closeLocked();
+        // 禁止新的写入并等待正在写映射的线程结束
+        void sealLocked();
+        void rotate(uint32_t gen);
+        // 保证文件至少有end字节
+        bool grow(uint64_t end);
 
     private:
         string m_filename;
-        ofstream m_fileStream;
+        uint64_t m_maxSize;
+        uint64_t m_chunkSize;
+        int m_fd = -1;
+        char *m_base = nullptr;
+        atomic<uint64_t> m_offset{0};    // 已经分配出去的偏移
+        atomic<uint64_t> m_committed{0}; // 文件已经预分配的长度
+        atomic<uint64_t> m_tail{0};      // 跨过文件末尾没写进去的那条日志的偏移，文件实际长度不超过它
+        atomic<uint32_t> m_writers{0};   // 正在写映射的线程数
+        atomic<bool> m_sealed{true};     // 正在切分或文件没打开
+        atomic<uint32_t> m_gen{0};       // 打开过的文件数，用来判断是否已经切分过
+        atomic<uint32_t> m_reopenGen;
+        time_t m_openTime = 0;
+        uint32_t m_maxFiles = 0;
+        bool m_compress = false;
+        atomic<bool> m_failing{false};   // 上一次打开或预分配失败了，成功之前不再打印
+        atomic<uint64_t> m_errors{0};
+        atomic<uint64_t> m_dropped{0};
+        mutex m_mutex;     // 打开、切分、关闭
+        mutex m_growMutex; // 扩展文件
+    };
+
+    /*
+        通过io_uring写文件：日志拷贝进几块注册过的缓存，写满、到时间或遇到ERROR时提交IORING_OP_WRITE_FIXED，
+        写日志和定时刷新的线程不在write里阻塞，只有所有缓存都在等待写出时才等完成。
+        同一时间只有一个写请求，文件里的顺序和日志顺序一致。内核不支持io_uring(或被禁用)时退化成同步write。
+        不做切分，配合logrotate用FileLogAppender::RequestReopen重新打开
+    */
+    class UringFileLogAppender : public LogAppender
+    {
+    public:
+        typedef shared_ptr<UringFileLogAppender> ptr;
+        // buffer_size: 每块缓存的字节数; buffers: 缓存块数; flush_interval: 最长多少毫秒提交一次
+        UringFileLogAppender(const string &filename, size_t buffer_size = 256 * 1024, uint32_t buffers = 4,
+                             uint32_t flush_interval = 1000);
+        ~UringFileLogAppender();
+        void log(Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event) override;
+        // 提交已有的内容，不等待写完
+        void flush() override;
+        // 等待已提交的内容全部写完
+        void sync();
+        bool reopen();
+        const string &getFilename() const { return m_filename; }
+        // 每次写完后fdatasync，io_uring下和写请求链接在一起异步执行
+        void setFsync(bool v) { m_fsync = v; }
+        // 是否在用io_uring
+        bool isUring() const { return m_uring != nullptr; }
+        // 打开、提交、写入、fsync失败的次数，连续失败只在第一次打印到stderr
+        uint64_t getErrors() const { return m_errors.load(memory_order_relaxed); }
+        // 文件打不开或写失败时丢掉的字节数
+        uint64_t getDropped() const { return m_dropped.load(memory_order_relaxed); }
+
+    private:
+        struct Uring;
+        // 记录一次失败，err是错误码
+        void errorLocked(const char *what, int err);
+        bool openLocked();
+        void appendLocked(const char *data, size_t len);
+        void submitLocked();
+        // 提交正在填的缓存
+        void sealLocked();
+        // 处理完成的请求并提交下一个，wait时至少等一个完成
+        void reapLocked(bool wait);
+        void syncLocked();
+
+    private:
+        string m_filename;
+        int m_fd = -1;
+        unique_ptr<Uring> m_uring;
+        char *m_buffers = nullptr;  // buffers块连续的缓存
+        size_t m_bufferSize;
+        uint32_t m_bufferCount;
+        vector<size_t> m_lengths;   // 每块缓存里的字节数
+        uint64_t m_fillSeq = 0;     // 正在填的缓存序号，块下标是序号对块数取模
+        uint64_t m_writeSeq = 0;    // 下一个要写出的缓存序号，和m_fillSeq之间的都已写满等待写出
+        size_t m_written = 0;       // 正在写的缓存已写出的字节数(短写后接着写)
+        uint32_t m_inflight = 0;    // 内核里没完成的请求数(写和链接的fsync)，为0时才提交下一个写
+        uint32_t m_flushInterval;
+        uint64_t m_lastFlush = 0;
+        uint32_t m_reopenGen;
+        bool m_fsync = false;
+        bool m_failing = false;     // 上一次操作失败了，成功写出之前不再打印
+        atomic<uint64_t> m_errors{0};
+        atomic<uint64_t> m_dropped{0};
+        mutex m_mutex;
+    };
+
+    // 异步输出地：生产者把事件放进有界的无锁环形队列，后台线程取出后交给下游appender输出
+    class AsyncLogAppender : public LogAppender
+    {
+    public:
+        typedef shared_ptr<AsyncLogAppender> ptr;
+        // 队列满时的处理策略
+        enum OverflowPolicy
+        {
+            BLOCK = 0,       // 阻塞等待消费者腾出空间
+            DROP_NEWEST,     // 丢弃当前这条
+            DROP_DEBUG_FIRST // 超过高水位后先丢DEBUG，满了以后其它级别阻塞
+        };
+
+        AsyncLogAppender(size_t capacity = 8192, OverflowPolicy policy = BLOCK);
+        ~AsyncLogAppender();
+        void log(Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event) override;
+        // 等待调用前入队的事件全部输出，再刷新下游appender
+        void flush() override;
+        // 排空队列并停止后台线程，之后的事件同步输出
+        void stop();
+
+        void addAppender(LogAppender::ptr appender);
+        void delAppender(LogAppender::ptr appender);
+        OverflowPolicy getOverflowPolicy() const { return m_policy; }
+        void setOverflowPolicy(OverflowPolicy policy) { m_policy = policy; }
+        uint64_t getDropped() const { return m_dropped.load(memory_order_relaxed); }
+        size_t getCapacity() const { return m_mask + 1; }
+
+    private:
+        struct Slot
+        {
+            atomic<uint64_t> seq;
+            Logger::ptr logger;
+            LogEvent::ptr event;
+            LogLevel::Level level;
+        };
+        bool tryPush(Logger::ptr &logger, LogLevel::Level level, LogEvent::ptr &event);
+        bool tryPop(Logger::ptr &logger, LogLevel::Level &level, LogEvent::ptr &event);
+        size_t size() const;
+        void wakeConsumer();
+        void logSync(Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event);
+        void run();
+
+    private:
+        unique_ptr<Slot[]> m_slots;
+        size_t m_mask;
+        OverflowPolicy m_policy;
+        atomic<uint64_t> m_tail{0};      // 生产者申请的位置
+        atomic<uint64_t> m_head{0};      // 消费者已经输出完的位置
+        atomic<uint64_t> m_dropped{0};   // 丢弃的事件数
+        atomic<bool> m_sleeping{false};  // 消费者是否在等待
+        atomic<int> m_waiting{0};        // 等待消费进度的线程数(队列满的生产者和flush)
+        atomic<bool> m_stop{false};
+        mutex m_mutex;
+        condition_variable m_cond;       // 唤醒消费者
+        condition_variable m_doneCond;   // 通知flush和阻塞的生产者
+        mutex m_appendersMutex;
+        list<LogAppender::ptr> m_appenders; // 下游appender
+        Thread::ptr m_thread;
+    };
+
+    /*
+        飞行记录仪：每个线程在预分配的环里保留最近capacity条未格式化的事件，平时不做格式化和IO。
+        写入只拷贝进本线程环里预先分配好的事件(复用内存，不分配)，只拿本线程环的锁，dump时才会有竞争。
+        达到trigger级别的事件、显式调用dump()或收到信号时，把所有线程的记录按时间合并(同一线程内保持写入顺序)
+        交给目标appender输出并清空。线程退出后它的环保留到下一次dump，最多保留kMaxExitedRings个
+    */
+    class RingBufferLogAppender : public LogAppender
+    {
+    public:
+        typedef shared_ptr<RingBufferLogAppender> ptr;
+        static const size_t kMaxExitedRings = 64;
+
+        RingBufferLogAppender(LogAppender::ptr target, size_t capacity = 1024, LogLevel::Level trigger = LogLevel::ERROR);
+        ~RingBufferLogAppender();
+        void log(Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event) override;
+        // 处理信号请求的dump(后台每秒检查一次)，再刷新目标appender
+        void flush() override;
+        // 输出并清空所有线程的记录
+        void dump();
+        LogAppender::ptr getTarget() const { return m_target; }
+        LogLevel::Level getTrigger() const { return m_trigger; }
+        void setTrigger(LogLevel::Level level) { m_trigger = level; }
+
+        // 通知所有RingBufferLogAppender dump，可以在信号处理函数里调用
+        static void RequestDump();
+        // 收到sig时dump
+        static void InstallDumpSignal(int sig = SIGUSR2);
+
+    private:
+        struct Ring
+        {
+            mutex mtx;
+            vector<LogEvent::ptr> entries;
+            vector<LogEvent::ptr> spare; // dump时和entries交换，不在锁里输出
+            size_t next = 0;             // 下一条写的位置
+            size_t size = 0;
+        };
+        // 所有线程的环，线程退出时通过weak_ptr找到
+        struct Rings
+        {
+            mutex mtx;
+            map<uint32_t, shared_ptr<Ring>> live; // 线程id -> 环
+            deque<shared_ptr<Ring>> exited;       // 已退出线程还没dump的环
+        };
+        Ring *getRing();
+        shared_ptr<Ring> newRing() const;
+
+    private:
+        LogAppender::ptr m_target;
+        size_t m_capacity;        // 每个线程保留的条数
+        LogLevel::Level m_trigger;
+        uint64_t m_id;            // 进程内唯一，用于线程缓存
+        atomic<uint32_t> m_dumpGen; // 已处理的dump请求
+        shared_ptr<Rings> m_rings;
+        mutex m_dumpMutex;
     };
 
     class LoggerManager
     {
     public:
         LoggerManager();
+        ~LoggerManager();
         Logger::ptr getLogger(const string &name);
         void init();
         Logger::ptr getRoot() const { return m_root; }
 
     private:
         Logger::ptr m_root;
-        map<string, Logger::ptr> m_loggers;
+        Snapshot<map<string, Logger::ptr>> m_loggers; // 写时复制，getLogger不加锁
     };
 
     typedef jyl::Singleton<LoggerManager> loggerManager;
@@ -0,0 +1,145 @@
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <vector>
+#include <utility>
+
+using namespace std;
+
+namespace jyl
+{
+    namespace detail
+    {
+        // 每个线程的hazard指针：读者在访问对象前登记，写者替换对象后只回收没有被登记的旧对象
+        class HazardGuard
+        {
+        public:
+            HazardGuard();
+            HazardGuard(HazardGuard &&other) : m_slot(other.m_slot) { other.m_slot = nullptr; }
+            ~HazardGuard();
+            // 线程的hazard槽用完了(嵌套太深或线程正在退出)
+            bool valid() const { return m_slot != nullptr; }
+            void protect(const void *p) { m_slot->store(p); }
+
+        private:
+            HazardGuard(const HazardGuard &) = delete;
+            HazardGuard &operator=(const HazardGuard &) = delete;
+            atomic<const void *> *m_slot;
+        };
+
+        // 是否有线程正在读p
+        bool IsHazard(const void *p);
+    }
+
+    /*
+        写时复制的不可变快照：读者不加锁也不改共享的引用计数，写者在锁内复制一份修改后整体替换。
+        替换下来的旧对象如果还有线程在读，留到之后的写入或析构时再释放
+    */
+    template <class T>
+    class Snapshot
+    {
+    public:
+        typedef shared_ptr<const T> ConstPtr;
+
+        // 读到的版本，存活期间对象不会被释放。占用本线程一个hazard槽，只在当前线程短时间使用
+        class Ref
+        {
+        public:
+            Ref(Ref &&) = default;
+            const T &operator*() const { return *m_ptr; }
+            const T *operator->() const { return m_ptr; }
+            const T *get() const { return m_ptr; }
+
+        private:
+            friend class Snapshot;
+            Ref() = default;
+            Ref(const Ref &) = delete;
+            Ref &operator=(const Ref &) = delete;
+
+            detail::HazardGuard m_guard;
+            const T *m_ptr = nullptr;
+            ConstPtr m_hold; // hazard槽用完时改为持有引用
+        };
+
+        Snapshot() : Snapshot(make_shared<const T>()) {}
+        explicit Snapshot(ConstPtr data) : m_data(data), m_ptr(data.get()) {}
+
+        // 在f(const T&)执行期间对象不会被释放，f里可以再读其它快照
+        template <class F>
+        auto read(F f) const -> decltype(f(declval<const T &>()))
+        {
+            Ref r = ref();
+            return f(*r);
+        }
+
+        Ref ref() const
+        {
+            Ref r;
+            if (!r.m_guard.valid())
+            {
+                r.m_hold = get();
+                r.m_ptr = r.m_hold.get();
+                return r;
+            }
+            const T *p = m_ptr.load();
+            while (true)
+            {
+                r.m_guard.protect(p);
+                const T *q = m_ptr.load();
+                if (p == q)
+                {
+                    break;
+                }
+                p = q;
+            }
+            r.m_ptr = p;
+            return r;
+        }
+
+        // 持有当前版本，要加锁，适合需要长时间保留的地方
+        ConstPtr get() const
+        {
+            lock_guard<mutex> lock(m_mutex);
+            return m_data;
+        }
+
+        // 复制当前版本，交给f(T&)修改后发布
+        template <class F>
+        void update(F f)
+        {
+            lock_guard<mutex> lock(m_mutex);
+            shared_ptr<T> data = make_shared<T>(*m_data);
+            f(*data);
+            publishLocked(data);
+        }
+
+        void store(ConstPtr data)
+        {
+            lock_guard<mutex> lock(m_mutex);
+            publishLocked(data);
+        }
+
+    private:
+        void publishLocked(ConstPtr data)
+        {
+            m_retired.push_back(m_data);
+            m_data = data;
+            m_ptr.store(data.get());
+            for (auto it = m_retired.begin(); it != m_retired.end();)
+            {
+                it = detail::IsHazard(it->get()) ? ++it : m_retired.erase(it);
+            }
+        }
+
+    private:
+        Snapshot(const Snapshot &) = delete;
+        Snapshot &operator=(const Snapshot &) = delete;
+
+        mutable mutex m_mutex;       // 写者互斥
+        ConstPtr m_data;             // 当前版本
+        atomic<const T *> m_ptr;     // 读者看到的当前版本
+        vector<ConstPtr> m_retired;  // 替换下来还有读者的旧版本
+    };
+}
@@ -5,9 +5,67 @@
 #include <sys/syscall.h>
 #include <unistd.h>
 #include <stdint.h>
+#include <time.h>
+#include <string>
+#include <thread>
+#include <functional>
+#include <memory>
+
+using namespace std;
 
 namespace jyl
 {
+    // 当前线程的tid，第一次调用后缓存在线程局部变量里，fork后在子进程里重新获取
     pid_t getThreadID();
     uint32_t getFiberID();
-}
\ No newline at end of file
+    // 当前时间，微秒
+    uint64_t getRealTimeUS();
+
+    // 单调时钟，不受系统时间调整影响，用于计时。
+    // 毫秒用CLOCK_MONOTONIC_COARSE(只读vdso里的数据，精度1~4ms)，内核不支持时用CLOCK_MONOTONIC
+    uint64_t getCurrentMS();
+    uint64_t getCurrentUS();
+    // 进程启动(第一次调用)后经过的毫秒数，精度同getCurrentMS
+    uint32_t getElapsedMS();
+
+    /*
+        CPU周期计数器，用来测量很短的时间间隔。
+        x86上CPU支持invariant TSC时用rdtsc，否则是CLOCK_MONOTONIC的纳秒数(Frequency为1e9)。
+        频率在第一次调用Frequency时对照CLOCK_MONOTONIC校准，大约花10ms
+    */
+    class CycleClock
+    {
+    public:
+        static uint64_t Now();
+        // 每秒的周期数
+        static double Frequency();
+        static uint64_t ToNS(uint64_t cycles) { return cycles * 1e9 / Frequency(); }
+        // 是否在用rdtsc
+        static bool IsTSC();
+    };
+
+    // 带名字的线程，名字在线程启动时设置，同时设到内核里(top -H、gdb能看到)
+    class Thread
+    {
+    public:
+        typedef shared_ptr<Thread> ptr;
+        Thread(function<void()> cb, const string &name);
+        // 没有join的线程会被detach
+        ~Thread();
+        void join();
+        bool joinable() const { return m_thread.joinable(); }
+        const string &getName() const { return m_name; }
+
+        // 当前线程的名字，最多15个字符，没设置过的线程取内核里的名字
+        static const char *GetName();
+        static void SetName(const string &name);
+
+    private:
+        Thread(const Thread &) = delete;
+        Thread &operator=(const Thread &) = delete;
+
+    private:
+        string m_name;
+        thread m_thread;
+    };
+}
@@ -0,0 +1,522 @@
+#include "../include/binlog.h"
+
+namespace jyl
+{
+    const char BinaryLogAppender::kMagic[8] = {'J', 'Y', 'L', 'B', 'L', 'O', 'G', '\0'};
+
+    BinLogSite::BinLogSite(LogLevel::Level level, const char *file, int32_t line, const char *fmt, const char *types)
+        : level(level), file(file), line(line), fmt(fmt), types(types)
+    {
+        static atomic<uint32_t> s_id{0};
+        id = s_id++;
+    }
+
+    namespace detail
+    {
+        string &BinLogBuffer()
+        {
+            static thread_local string t_buf;
+            return t_buf;
+        }
+
+        template <class T>
+        static bool ReadRaw(const char *&p, const char *end, T &v)
+        {
+            if ((size_t)(end - p) < sizeof(T))
+            {
+                return false;
+            }
+            memcpy(&v, p, sizeof(T));
+            p += sizeof(T);
+            return true;
+        }
+
+        bool BinDecode(LogStream &os, const char *fmt, const char *types, const char *args, size_t len)
+        {
+            const char *p = args;
+            const char *end = args + len;
+            for (; *types; ++types)
+            {
+                const char *next = AppendUntilPlaceholder(os, fmt);
+                if (!next)
+                {
+                    return true;
+                }
+                fmt = next;
+                switch (*types)
+                {
+                case 'i':
+                {
+                    int64_t v;
+                    if (!ReadRaw(p, end, v))
+                        return false;
+                    os << (long long)v;
+                    break;
+                }
+                case 'u':
+                {
+                    uint64_t v;
+                    if (!ReadRaw(p, end, v))
+                        return false;
+                    os << (unsigned long long)v;
+                    break;
+                }
+                case 'd':
+                {
+                    double v;
+                    if (!ReadRaw(p, end, v))
+                        return false;
+                    os << v;
+                    break;
+                }
+                case 'b':
+                case 'c':
+                {
+                    char v;
+                    if (!ReadRaw(p, end, v))
+                        return false;
+                    if (*types == 'b')
+                        os << (bool)v;
+                    else
+                        os << v;
+                    break;
+                }
+                case 's':
+                {
+                    uint32_t n;
+                    if (!ReadRaw(p, end, n) || (size_t)(end - p) < n)
+                        return false;
+                    os.append(p, n);
+                    p += n;
+                    break;
+                }
+                default:
+                    return false;
+                }
+            }
+            AppendUntilPlaceholder(os, fmt);
+            return true;
+        }
+    }
+
+    bool LogAppender::logBinary(Logger *, const BinLogSite &, const char *, size_t, uint64_t, uint32_t, uint32_t, uint32_t)
+    {
+        return false;
+    }
+
+    // 线程最近用过的几个logger的appender集合，按版本判断是否过期，不用每条日志都读快照
+    namespace
+    {
+        struct AppendersCache
+        {
+            const Logger *logger = nullptr; // 只用来比较
+            uint64_t version = 0;
+            shared_ptr<const vector<LogAppender::ptr>> appenders;
+        };
+    }
+    static const int kAppendersCacheSize = 4;
+    static thread_local AppendersCache t_appendersCache[kAppendersCacheSize];
+    static thread_local int t_appendersCacheNext = 0;
+    static thread_local int t_binaryDepth = 0; // 嵌套时不用缓存，避免换掉外层正在遍历的集合
+
+    void Logger::logBinary(const BinLogSite &site, const char *args, size_t len, uint64_t time_us)
+    {
+        if (site.level < m_level)
+        {
+            return;
+        }
+        const vector<LogAppender::ptr> *appenders = nullptr;
+        shared_ptr<const vector<LogAppender::ptr>> hold;
+        if (t_binaryDepth == 0)
+        {
+            uint64_t version = m_appendersVersion.load(memory_order_acquire);
+            AppendersCache *cache = nullptr;
+            for (auto &i : t_appendersCache)
+            {
+                if (i.logger == this)
+                {
+                    cache = &i;
+                    break;
+                }
+            }
+            if (!cache)
+            {
+                cache = &t_appendersCache[t_appendersCacheNext];
+                t_appendersCacheNext = (t_appendersCacheNext + 1) % kAppendersCacheSize;
+                cache->logger = this;
+                cache->version = 0;
+            }
+            if (cache->version != version)
+            {
+                // 先读版本再取集合，取到的不会比版本旧
+                cache->appenders = m_appenders.get();
+                cache->version = version;
+            }
+            appenders = cache->appenders.get();
+        }
+        else
+        {
+            hold = m_appenders.get();
+            appenders = hold.get();
+        }
+        // 和文本日志一样，限流算在有appender的logger上
+        if (appenders->empty())
+        {
+            if (m_root)
+            {
+                m_root->logBinary(site, args, len, time_us);
+            }
+            return;
+        }
+        if (!rateAllow(site.level))
+        {
+            return;
+        }
+        uint32_t elapse = getElapsedMS();
+        uint32_t thread_id = getThreadID();
+        uint32_t fiber_id = getFiberID();
+        LogEvent::ptr note = takeRateNote(site.file, site.line, elapse, thread_id, fiber_id, time_us);
+        // 不支持二进制的appender共用一次还原和格式化
+        LogEvent::ptr event;
+        detail::FormatMemoScope memo;
+        ++t_binaryDepth;
+        for (auto &i : *appenders)
+        {
+            if (note)
+            {
+                i->log(note->getLogger(), LogLevel::WARN, note);
+            }
+            if (site.level < i->getLevel() || i->logBinary(this, site, args, len, time_us, elapse, thread_id, fiber_id))
+            {
+                continue;
+            }
+            if (!event)
+            {
+                event = LogEvent::Acquire(shared_from_this(), site.level, site.file, site.line, elapse, thread_id, fiber_id, time_us);
+                detail::BinDecode(event->getSS(), site.fmt, site.types, args, len);
+            }
+            i->log(event->getLogger(), site.level, event);
+        }
+        --t_binaryDepth;
+    }
+
+    template <class T>
+    static void Put(string &buf, T v)
+    {
+        buf.append((const char *)&v, sizeof(v));
+    }
+
+    template <class L>
+    static void PutString(string &buf, const char *data, size_t len)
+    {
+        L n = len;
+        Put(buf, n);
+        buf.append(data, n);
+    }
+
+    // 定长的部分先拼在栈上，一次追加
+    template <class T>
+    static char *PutRaw(char *p, T v)
+    {
+        memcpy(p, &v, sizeof(v));
+        return p + sizeof(v);
+    }
+
+    static atomic<uint64_t> s_binAppenderId{0};
+
+    // 线程最近用过的几个BinaryLogAppender的缓存，appender的id不会复用
+    static const int kBufferCacheSize = 4;
+    static thread_local pair<uint64_t, void *> t_bufferCache[kBufferCacheSize];
+    static thread_local int t_bufferCacheNext = 0;
+
+    BinaryLogAppender::BinaryLogAppender(const string &filename, size_t buffer_size, uint32_t flush_interval)
+        : FileLogAppender(filename, buffer_size, flush_interval, false), m_id(++s_binAppenderId),
+          m_threads(make_shared<ThreadBuffers>())
+    {
+        m_threads->owner = this;
+        {
+            // 基类构造时还调用不到这里的onFileOpened
+            lock_guard<mutex> lock(m_mutex);
+            onFileOpened();
+        }
+        // flush要用到m_threads，构造完才交给后台刷新
+        attachFlusher();
+    }
+
+    BinaryLogAppender::~BinaryLogAppender()
+    {
+        // 先停掉后台刷新，之后不会再有线程调用flush
+        detachFlusher();
+        lock_guard<mutex> lock(m_threads->mtx);
+        for (auto &i : m_threads->live)
+        {
+            lock_guard<mutex> tb_lock(i.second->mtx);
+            handOff(*i.second);
+        }
+        m_threads->owner = nullptr;
+        m_threads->live.clear();
+    }
+
+    void BinaryLogAppender::onFileOpened()
+    {
+        if (m_fileSize == 0)
+        {
+            string header(kMagic, sizeof(kMagic));
+            Put(header, kVersion);
+            m_buffer.insert(0, header);
+        }
+        m_sites.clear();
+        m_loggers.clear();
+    }
+
+    BinaryLogAppender::ThreadBuffer *BinaryLogAppender::getThreadBuffer()
+    {
+        for (auto &i : t_bufferCache)
+        {
+            if (i.first == m_id)
+            {
+                return (ThreadBuffer *)i.second;
+            }
+        }
+        uint32_t tid = getThreadID();
+        ThreadBuffer *tb;
+        bool created = false;
+        {
+            lock_guard<mutex> lock(m_threads->mtx);
+            shared_ptr<ThreadBuffer> &b = m_threads->live[tid];
+            if (!b)
+            {
+                b = make_shared<ThreadBuffer>();
+                b->buf.reserve(kThreadBufferSize + 4096);
+                created = true;
+            }
+            tb = b.get();
+        }
+        if (created)
+        {
+            // 线程退出时把剩下的记录交给文件缓存
+            weak_ptr<ThreadBuffers> weak = m_threads;
+            uint64_t id = m_id;
+            bool registered = detail::AtThreadExit([weak, tid, id]()
+                                                   {
+                                                       for (auto &i : t_bufferCache)
+                                                       {
+                                                           if (i.first == id)
+                                                           {
+                                                               i = make_pair(0, nullptr);
+                                                           }
+                                                       }
+                                                       shared_ptr<ThreadBuffers> threads = weak.lock();
+                                                       if (!threads)
+                                                       {
+                                                           return;
+                                                       }
+                                                       lock_guard<mutex> lock(threads->mtx);
+                                                       auto it = threads->live.find(tid);
+                                                       if (it == threads->live.end())
+                                                       {
+                                                           return;
+                                                       }
+                                                       if (threads->owner)
+                                                       {
+                                                           lock_guard<mutex> tb_lock(it->second->mtx);
+                                                           threads->owner->handOff(*it->second);
+                                                       }
+                                                       threads->live.erase(it); });
+            if (!registered)
+            {
+                lock_guard<mutex> lock(m_threads->mtx);
+                m_threads->live.erase(tid);
+                return nullptr;
+            }
+        }
+        t_bufferCache[t_bufferCacheNext] = make_pair(m_id, (void *)tb);
+        t_bufferCacheNext = (t_bufferCacheNext + 1) % kBufferCacheSize;
+        return tb;
+    }
+
+    void BinaryLogAppender::listSite(ThreadBuffer &tb, const BinLogSite &site)
+    {
+        if (site.id >= tb.listed.size())
+        {
+            tb.listed.resize(site.id + 1);
+        }
+        if (!tb.listed[site.id])
+        {
+            tb.listed[site.id] = true;
+            tb.sites.push_back(&site);
+        }
+    }
+
+    void BinaryLogAppender::listLogger(ThreadBuffer &tb, const Logger *logger)
+    {
+        for (auto &i : tb.loggers)
+        {
+            if (i.first == logger->getId())
+            {
+                return;
+            }
+        }
+        tb.loggers.push_back(make_pair(logger->getId(), logger->getName()));
+    }
+
+    void BinaryLogAppender::handOff(ThreadBuffer &tb)
+    {
+        if (tb.buf.empty())
+        {
+            return;
+        }
+        {
+            lock_guard<mutex> lock(m_mutex);
+            beforeAppendLocked();
+            for (auto i : tb.sites)
+            {
+                siteLocked(*i);
+            }
+            for (auto &i : tb.loggers)
+            {
+                loggerLocked(i.first, i.second);
+            }
+            m_buffer.append(tb.buf);
+            afterAppendLocked(tb.level);
+        }
+        tb.buf.clear();
+        for (auto i : tb.sites)
+        {
+            tb.listed[i->id] = false;
+        }
+        tb.sites.clear();
+        tb.loggers.clear();
+        tb.level = LogLevel::DEBUG;
+    }
+
+    void BinaryLogAppender::loggerLocked(uint32_t id, const string &name)
+    {
+        if (id < m_loggers.size() && m_loggers[id])
+        {
+            return;
+        }
+        if (id >= m_loggers.size())
+        {
+            m_loggers.resize(id + 1);
+        }
+        m_loggers[id] = true;
+        Put<uint8_t>(m_buffer, RECORD_LOGGER);
+        Put(m_buffer, id);
+        PutString<uint16_t>(m_buffer, name.data(), name.size());
+    }
+
+    void BinaryLogAppender::siteLocked(const BinLogSite &site)
+    {
+        if (site.id < m_sites.size() && m_sites[site.id])
+        {
+            return;
+        }
+        if (site.id >= m_sites.size())
+        {
+            m_sites.resize(site.id + 1);
+        }
+        m_sites[site.id] = true;
+        Put<uint8_t>(m_buffer, RECORD_SITE);
+        Put(m_buffer, site.id);
+        Put<uint8_t>(m_buffer, site.level);
+        Put(m_buffer, site.line);
+        PutString<uint16_t>(m_buffer, site.file, strlen(site.file));
+        PutString<uint16_t>(m_buffer, site.fmt, strlen(site.fmt));
+        PutString<uint16_t>(m_buffer, site.types, strlen(site.types));
+    }
+
+    bool BinaryLogAppender::logBinary(Logger *logger, const BinLogSite &site, const char *args, size_t len,
+                                      uint64_t time_us, uint32_t elapse, uint32_t thread_id, uint32_t fiber_id)
+    {
+        if (site.level < m_level)
+        {
+            return true;
+        }
+        auto encode = [&](ThreadBuffer &tb)
+        {
+            listSite(tb, site);
+            listLogger(tb, logger);
+            char head[1 + 4 + 4 + 8 + 4 + 4 + 4 + 4];
+            char *p = PutRaw<uint8_t>(head, RECORD_EVENT);
+            p = PutRaw(p, site.id);
+            p = PutRaw(p, logger->getId());
+            p = PutRaw(p, time_us);
+            p = PutRaw(p, elapse);
+            p = PutRaw(p, thread_id);
+            p = PutRaw(p, fiber_id);
+            p = PutRaw<uint32_t>(p, len);
+            tb.buf.append(head, p - head);
+            tb.buf.append(args, len);
+            tb.level = max(tb.level, site.level);
+        };
+        ThreadBuffer *tb = getThreadBuffer();
+        if (!tb)
+        {
+            ThreadBuffer local;
+            encode(local);
+            handOff(local);
+            return true;
+        }
+        lock_guard<mutex> lock(tb->mtx);
+        encode(*tb);
+        // 错误日志立即交出去，由afterAppendLocked落盘
+        if (site.level >= LogLevel::ERROR || tb->buf.size() >= min(m_bufferSize, kThreadBufferSize))
+        {
+            handOff(*tb);
+        }
+        return true;
+    }
+
+    void BinaryLogAppender::log(Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event)
+    {
+        if (level < m_level)
+        {
+            return;
+        }
+        // 和同一个线程的二进制记录走同一个缓存，保持先后顺序
+        auto encode = [&](ThreadBuffer &tb)
+        {
+            listLogger(tb, logger.get());
+            const string &content = event->getContent();
+            Put<uint8_t>(tb.buf, RECORD_TEXT);
+            Put(tb.buf, logger->getId());
+            Put<uint8_t>(tb.buf, level);
+            Put(tb.buf, event->getTimeUS());
+            Put(tb.buf, event->getElapsed());
+            Put(tb.buf, event->getThreadID());
+            Put(tb.buf, event->getFiberID());
+            Put(tb.buf, event->getLine());
+            PutString<uint16_t>(tb.buf, event->getFile(), strlen(event->getFile()));
+            PutString<uint32_t>(tb.buf, content.data(), content.size());
+            tb.level = max(tb.level, level);
+        };
+        ThreadBuffer *tb = getThreadBuffer();
+        if (!tb)
+        {
+            ThreadBuffer local;
+            encode(local);
+            handOff(local);
+            return;
+        }
+        lock_guard<mutex> lock(tb->mtx);
+        encode(*tb);
+        if (level >= LogLevel::ERROR || tb->buf.size() >= min(m_bufferSize, kThreadBufferSize))
+        {
+            handOff(*tb);
+        }
+    }
+
+    void BinaryLogAppender::flush()
+    {
+        {
+            lock_guard<mutex> lock(m_threads->mtx);
+            for (auto &i : m_threads->live)
+            {
+                lock_guard<mutex> tb_lock(i.second->mtx);
+                handOff(*i.second);
+            }
+        }
+        FileLogAppender::flush();
+    }
+}
@@ -1,66 +1,690 @@
 #include "../include/config.h"
 #include <list>
 #include "../include/log.h"
+#include "../include/util.h"
 #include <string>
+#include <fstream>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <zlib.h>
+#include <sys/inotify.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 namespace jyl
 {
 
-    Config::ConfigVarMap Config::s_datas;
+    // 按"."切开，空段忽略
+    static vector<string> SplitName(const string &name)
+    {
+        vector<string> parts;
+        size_t begin = 0;
+        while (begin <= name.size())
+        {
+            size_t end = name.find('.', begin);
+            if (end == string::npos)
+            {
+                end = name.size();
+            }
+            if (end > begin)
+            {
+                parts.push_back(name.substr(begin, end - begin));
+            }
+            begin = end + 1;
+        }
+        return parts;
+    }
+
+    void Config::Register(const string &name, ConfigVarBase::ptr var)
+    {
+        GetDatas()[name] = var;
+        // 树里用小写的名字，和加载时小写后的yaml路径对应
+        TrieNode *node = &GetTrie();
+        for (auto &i : SplitName(var->getName()))
+        {
+            unique_ptr<TrieNode> &child = node->children[i];
+            if (!child)
+            {
+                child.reset(new TrieNode);
+            }
+            node = child.get();
+        }
+        node->var = var;
+    }
+
+    const Config::TrieNode *Config::FindNode(const string &name)
+    {
+        string lower = name;
+        transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+        const TrieNode *node = &GetTrie();
+        for (auto &i : SplitName(lower))
+        {
+            auto it = node->children.find(i);
+            if (it == node->children.end())
+            {
+                return nullptr;
+            }
+            node = it->second.get();
+        }
+        return node;
+    }
 
     ConfigVarBase::ptr Config::lookupBase(const string &name)
     {
+        auto it = GetDatas().find(name);
+        if (it != GetDatas().end())
+        {
+            return it->second;
+        }
+        // 注册时名字里有大写的，按小写后的名字找
+        const TrieNode *node = FindNode(name);
+        return node ? node->var : nullptr;
+    }
+
+    void Config::CollectNode(const TrieNode &trie, const YAML::Node &node,
+                             vector<pair<ConfigVarBase::ptr, YAML::Node>> &output)
+    {
+        if (trie.var)
+        {
+            output.push_back(make_pair(trie.var, node));
+        }
+        if (!node.IsMap() || trie.children.empty())
+        {
+            return;
+        }
+        for (auto it = node.begin(); it != node.end(); ++it)
+        {
+            string key = it->first.Scalar();
+            transform(key.begin(), key.end(), key.begin(), ::tolower);
+            // yaml的key里也可以带"."，例如"system.port: 80"
+            const TrieNode *child = &trie;
+            for (auto &i : SplitName(key))
+            {
+                auto c = child->children.find(i);
+                if (c == child->children.end())
+                {
+                    child = nullptr;
+                    break;
+                }
+                child = c->second.get();
+            }
+            if (child && child != &trie)
+            {
+                CollectNode(*child, it->second, output);
+            }
+        }
+    }
+
+    void Config::Collect(const YAML::Node &node, vector<pair<ConfigVarBase::ptr, YAML::Node>> &output)
+    {
+        CollectNode(GetTrie(), node, output);
+    }
+
+    void Config::VisitNode(const TrieNode &trie, const function<void(const ConfigVarBase::ptr &)> &cb)
+    {
+        if (trie.var)
+        {
+            cb(trie.var);
+        }
+        for (auto &i : trie.children)
+        {
+            VisitNode(*i.second, cb);
+        }
+    }
+
+    void Config::Visit(const string &prefix, function<void(const ConfigVarBase::ptr &)> cb)
+    {
+        const TrieNode *node = FindNode(prefix);
+        if (node)
+        {
+            VisitNode(*node, cb);
+        }
+    }
+
+    void Config::LoadFromYaml(const YAML::Node &node)
+    {
+        vector<pair<ConfigVarBase::ptr, YAML::Node>> nodes;
+        Collect(node, nodes);
+        for (auto &i : nodes)
+        {
+            i.first->fromNode(i.second);
+        }
+    }
+
+    /*
+        快照文件格式，整数都是本机字节序：
+        magic[8] version:u32
+        来源文件数:u32 {路径:string 大小:u64 crc32:u32}...
+        配置项数:u32 {名字:string 类型:string 值:string}...
+        前面所有内容的crc32:u32
+        string是u32长度加内容
+    */
+    static const char kSnapshotMagic[8] = {'J', 'Y', 'L', 'C', 'O', 'N', 'F', '\0'};
+    static const uint32_t kSnapshotVersion = 1;
+
+    // 文件内容的crc32，读不了返回false
+    static bool FileChecksum(const string &path, uint64_t &size, uint32_t &crc)
+    {
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+        {
+            return false;
+        }
+        char buf[64 * 1024];
+        ssize_t n;
+        size = 0;
+        crc = crc32(0, nullptr, 0);
+        while ((n = read(fd, buf, sizeof(buf))) > 0)
+        {
+            crc = crc32(crc, (const Bytef *)buf, n);
+            size += n;
+        }
+        close(fd);
+        return n == 0;
+    }
 
-        auto it = s_datas.find(name);
-        return it == s_datas.end() ? nullptr : it->second;
+    // 统一成"目录/文件名"，和inotify事件里的目录、文件名拼出来的一致
+    static pair<string, string> SplitPath(const string &path)
+    {
+        size_t pos = path.rfind('/');
+        if (pos == string::npos)
+        {
+            return make_pair(string("."), path);
+        }
+        return make_pair(pos == 0 ? string("/") : path.substr(0, pos), path.substr(pos + 1));
     }
 
-    static void ListAllMembers(const string &prefix, const YAML::Node &node, list<pair<string, YAML::Node>> &output)
+    // 完整写入，处理EINTR和部分写
+    static bool WriteAll(int fd, const char *data, size_t len)
     {
-        if (prefix.find_first_not_of("abcdefghijklmnopqrstuvwxyz._0123456789") != string::npos)
+        while (len > 0)
         {
+            ssize_t n = ::write(fd, data, len);
+            if (n < 0)
             {
-                jyl::Logger::ptr logger(new jyl::Logger);
-                JYL_LOG_LEVEL(logger, LogLevel::Level::DEBUG) << "config invalid name" << prefix << " = " << node;
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                return false;
             }
+            data += n;
+            len -= n;
         }
-        output.push_back(make_pair(prefix, node));
-        if (node.IsMap())
+        return true;
+    }
+
+    bool Config::SaveSnapshot(const string &path, const vector<string> &sources)
+    {
+        string out(kSnapshotMagic, sizeof(kSnapshotMagic));
+        out.append((const char *)&kSnapshotVersion, sizeof(kSnapshotVersion));
+        uint32_t count = sources.size();
+        out.append((const char *)&count, sizeof(count));
+        for (auto &i : sources)
         {
-            for (auto it = node.begin(); it != node.end(); ++it)
+            uint64_t size;
+            uint32_t crc;
+            if (!FileChecksum(i, size, crc))
             {
-                ListAllMembers(prefix.empty() ? it->first.Scalar() : prefix + "." + it->first.Scalar(),
-                               it->second, output);
+                JYL_LOG_ERROR(JYL_LOG_ROOT()) << "SaveSnapshot read " << i << " failed: " << strerror(errno);
+                return false;
             }
+            PutBinaryString(out, i);
+            out.append((const char *)&size, sizeof(size));
+            out.append((const char *)&crc, sizeof(crc));
+        }
+
+        size_t count_pos = out.size();
+        count = 0;
+        out.append((const char *)&count, sizeof(count));
+        string value;
+        Visit("", [&](const ConfigVarBase::ptr &var)
+              {
+                  var->toBinary(value);
+                  PutBinaryString(out, var->getName());
+                  PutBinaryString(out, var->getTypeName());
+                  PutBinaryString(out, value);
+                  ++count; });
+        memcpy(&out[count_pos], &count, sizeof(count));
+        uint32_t crc = crc32(0, (const Bytef *)out.data(), out.size());
+        out.append((const char *)&crc, sizeof(crc));
+
+        // 写临时文件再改名，别的进程不会读到写了一半的快照
+        string tmp = path + ".tmp";
+        int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0)
+        {
+            JYL_LOG_ERROR(JYL_LOG_ROOT()) << "SaveSnapshot open " << tmp << " failed: " << strerror(errno);
+            return false;
         }
+        // 落盘之后再改名，掉电后要么是旧快照要么是完整的新快照
+        bool ok = WriteAll(fd, out.data(), out.size()) && fsync(fd) == 0;
+        ok = close(fd) == 0 && ok;
+        if (!ok || rename(tmp.c_str(), path.c_str()) != 0)
+        {
+            JYL_LOG_ERROR(JYL_LOG_ROOT()) << "SaveSnapshot write " << path << " failed: " << strerror(errno);
+            unlink(tmp.c_str());
+            return false;
+        }
+        // 改名本身也要落盘
+        int dir_fd = open(SplitPath(path).first.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (dir_fd >= 0)
+        {
+            fsync(dir_fd);
+            close(dir_fd);
+        }
+        return true;
     }
 
-    void Config::LoadFromYaml(const YAML::Node &node)
+    static bool ApplySnapshot(const string &path, const char *data, size_t len, const vector<string> &sources)
     {
+        char magic[sizeof(kSnapshotMagic)];
+        uint32_t version = 0, crc = 0;
+        if (len < sizeof(magic) + sizeof(version) + sizeof(crc))
+        {
+            return false;
+        }
+        len -= sizeof(crc);
+        memcpy(&crc, data + len, sizeof(crc));
+        BinaryReader in(data, len);
+        if (crc != crc32(0, (const Bytef *)data, len) || !in.read(magic, sizeof(magic)) ||
+            memcmp(magic, kSnapshotMagic, sizeof(magic)) != 0 || !in.read(&version, sizeof(version)) ||
+            version != kSnapshotVersion)
+        {
+            JYL_LOG_WARN(JYL_LOG_ROOT()) << "LoadSnapshot " << path << ": corrupted or unsupported version";
+            return false;
+        }
 
-        list<pair<string, YAML::Node>> all_nodes;
-        ListAllMembers("", node, all_nodes);
-        for (auto &i : all_nodes)
+        // 来源文件要和调用方给的一致，内容也没变
+        uint32_t count = 0;
+        if (!in.readCount(count) || count != sources.size())
+        {
+            JYL_LOG_INFO(JYL_LOG_ROOT()) << "LoadSnapshot " << path << ": sources changed";
+            return false;
+        }
+        for (uint32_t i = 0; i < count; ++i)
         {
-            string key = i.first;
-            if (key.empty())
+            string name;
+            uint64_t size = 0, cur_size = 0;
+            uint32_t file_crc = 0, cur_crc = 0;
+            if (!in.readString(name) || !in.read(&size, sizeof(size)) || !in.read(&file_crc, sizeof(file_crc)) ||
+                name != sources[i] || !FileChecksum(name, cur_size, cur_crc) || size != cur_size || file_crc != cur_crc)
+            {
+                JYL_LOG_INFO(JYL_LOG_ROOT()) << "LoadSnapshot " << path << ": " << sources[i] << " changed";
+                return false;
+            }
+        }
+
+        if (!in.readCount(count))
+        {
+            return false;
+        }
+        // 先把所有值解码好，有一个不对就都不生效
+        vector<ConfigVarBase::Change::ptr> changes;
+        string name, type;
+        uint32_t value_len = 0;
+        for (uint32_t i = 0; i < count; ++i)
+        {
+            if (!in.readString(name) || !in.readString(type) || !in.read(&value_len, sizeof(value_len)))
+            {
+                return false;
+            }
+            // 值直接从映射的内存里解码，不复制
+            const char *value = data + (len - in.remaining());
+            if (!in.skip(value_len))
+            {
+                return false;
+            }
+            ConfigVarBase::ptr var = Config::lookupBase(name);
+            if (!var || var->getTypeName() != type)
             {
                 continue;
             }
-            transform(key.begin(), key.end(), key.begin(), ::tolower);
-            ConfigVarBase::ptr var = jyl::Config::lookupBase(key);
-            if (var)
+            ConfigVarBase::Change::ptr change;
+            if (!var->prepareBinary(value, value_len, change))
+            {
+                JYL_LOG_ERROR(JYL_LOG_ROOT()) << "LoadSnapshot " << path << ": invalid value for " << name
+                                              << ", nothing applied";
+                return false;
+            }
+            if (change)
             {
-                if (i.second.IsScalar())
+                changes.push_back(change);
+            }
+        }
+        if (!in.eof())
+        {
+            return false;
+        }
+        for (auto &i : changes)
+        {
+            i->publish();
+        }
+        for (auto &i : changes)
+        {
+            i->notify();
+        }
+        return true;
+    }
+
+    bool Config::LoadSnapshot(const string &path, const vector<string> &sources)
+    {
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+        {
+            return false;
+        }
+        struct stat st;
+        void *addr = MAP_FAILED;
+        if (fstat(fd, &st) == 0 && st.st_size > 0)
+        {
+            addr = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        }
+        close(fd);
+        if (addr == MAP_FAILED)
+        {
+            return false;
+        }
+        bool ok = ApplySnapshot(path, (const char *)addr, st.st_size, sources);
+        munmap(addr, st.st_size);
+        return ok;
+    }
+
+    bool ConfigVarBase::prepareBinary(const char *data, size_t len, Change::ptr &change)
+    {
+        // 不知道值的类型，只能在publish时按字符串加载
+        class StringChange : public Change
+        {
+        public:
+            StringChange(ConfigVarBase *var, const char *data, size_t len) : m_var(var), m_str(data, len) {}
+            void publish() override { m_var->fromString(m_str); }
+            void notify() override {}
+
+        private:
+            ConfigVarBase *m_var;
+            string m_str;
+        };
+        change.reset(new StringChange(this, data, len));
+        return true;
+    }
+
+    bool ConfigVarBase::prepare(const YAML::Node &node, Change::ptr &change)
+    {
+        // 不知道值的类型，只能在publish时直接加载
+        class NodeChange : public Change
+        {
+        public:
+            NodeChange(ConfigVarBase *var, const YAML::Node &node) : m_var(var), m_node(node) {}
+            void publish() override { m_var->fromNode(m_node); }
+            void notify() override {}
+
+        private:
+            ConfigVarBase *m_var;
+            YAML::Node m_node;
+        };
+        change.reset(new NodeChange(this, node));
+        return true;
+    }
+
+    // 两棵子树内容是否一样，map不看顺序
+    static bool NodeEqual(const YAML::Node &a, const YAML::Node &b)
+    {
+        if (a.Type() != b.Type())
+        {
+            return false;
+        }
+        switch (a.Type())
+        {
+        case YAML::NodeType::Scalar:
+            return a.Scalar() == b.Scalar();
+        case YAML::NodeType::Sequence:
+            if (a.size() != b.size())
+            {
+                return false;
+            }
+            for (size_t i = 0; i < a.size(); ++i)
+            {
+                if (!NodeEqual(a[i], b[i]))
+                {
+                    return false;
+                }
+            }
+            return true;
+        case YAML::NodeType::Map:
+            if (a.size() != b.size())
+            {
+                return false;
+            }
+            for (auto it = a.begin(); it != a.end(); ++it)
+            {
+                const YAML::Node other = b[it->first.Scalar()];
+                if (!other.IsDefined() || !NodeEqual(it->second, other))
                 {
-                    var->fromString(i.second.Scalar());
+                    return false;
+                }
+            }
+            return true;
+        default:
+            return true;
+        }
+    }
+
+    static string JoinPath(const string &dir, const string &name)
+    {
+        return dir == "/" ? dir + name : dir + "/" + name;
+    }
+
+    ConfigWatcher *ConfigWatcher::GetInstance()
+    {
+        static ConfigWatcher *s_watcher = new ConfigWatcher;
+        return s_watcher;
+    }
+
+    ConfigWatcher::ConfigWatcher()
+    {
+        m_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (m_fd < 0)
+        {
+            JYL_LOG_ERROR(JYL_LOG_ROOT()) << "ConfigWatcher inotify_init1 failed: " << strerror(errno);
+        }
+    }
+
+    bool ConfigWatcher::addFile(const string &path)
+    {
+        auto dir_name = SplitPath(path);
+        string key = JoinPath(dir_name.first, dir_name.second);
+        lock_guard<recursive_mutex> check_lock(m_checkMutex);
+        vector<ConfigVarBase::Change::ptr> changes;
+        int rt;
+        {
+            lock_guard<mutex> lock(m_mutex);
+            if (m_fd >= 0)
+            {
+                int wd = inotify_add_watch(m_fd, dir_name.first.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO);
+                if (wd < 0)
+                {
+                    JYL_LOG_ERROR(JYL_LOG_ROOT()) << "ConfigWatcher watch " << dir_name.first
+                                                  << " failed: " << strerror(errno);
                 }
                 else
                 {
-                    stringstream ss;
-                    ss << i.second;
-                    var->fromString(ss.str());
+                    m_dirs[wd] = dir_name.first;
                 }
             }
+            File &file = m_files[key];
+            file.path = path;
+            rt = reloadLocked(file, changes);
         }
+        Apply(changes);
+        return rt >= 0;
+    }
+
+    void ConfigWatcher::delFile(const string &path)
+    {
+        auto dir_name = SplitPath(path);
+        lock_guard<mutex> lock(m_mutex);
+        m_files.erase(JoinPath(dir_name.first, dir_name.second));
+        for (auto &i : m_files)
+        {
+            if (SplitPath(i.first).first == dir_name.first)
+            {
+                return;
+            }
+        }
+        for (auto it = m_dirs.begin(); it != m_dirs.end(); ++it)
+        {
+            if (it->second == dir_name.first)
+            {
+                inotify_rm_watch(m_fd, it->first);
+                m_dirs.erase(it);
+                break;
+            }
+        }
+    }
+
+    int ConfigWatcher::check(int timeout_ms)
+    {
+        if (m_fd < 0)
+        {
+            return 0;
+        }
+        struct pollfd pfd = {m_fd, POLLIN, 0};
+        if (poll(&pfd, 1, timeout_ms) <= 0)
+        {
+            return 0;
+        }
+        // 同时调用check时(比如后台线程和用户的事件循环)由一个调用读完并处理所有事件，另一个读不到事件直接返回
+        lock_guard<recursive_mutex> check_lock(m_checkMutex);
+        // 先读完所有事件，同一个文件多次改动只加载一次
+        set<pair<int, string>> changed;
+        char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+        while (true)
+        {
+            ssize_t n = read(m_fd, buf, sizeof(buf));
+            if (n <= 0)
+            {
+                break;
+            }
+            for (char *p = buf; p < buf + n;)
+            {
+                struct inotify_event *ev = (struct inotify_event *)p;
+                if (ev->len > 0)
+                {
+                    changed.insert(make_pair(ev->wd, string(ev->name)));
+                }
+                p += sizeof(struct inotify_event) + ev->len;
+            }
+        }
+        int count = 0;
+        vector<ConfigVarBase::Change::ptr> changes;
+        {
+            lock_guard<mutex> lock(m_mutex);
+            for (auto &i : changed)
+            {
+                auto dir = m_dirs.find(i.first);
+                if (dir == m_dirs.end())
+                {
+                    continue;
+                }
+                auto it = m_files.find(JoinPath(dir->second, i.second));
+                if (it != m_files.end())
+                {
+                    count += max(reloadLocked(it->second, changes), 0);
+                }
+            }
+        }
+        Apply(changes);
+        return count;
+    }
+
+    void ConfigWatcher::Apply(const vector<ConfigVarBase::Change::ptr> &changes)
+    {
+        // 全部生效后再通知
+        for (auto &i : changes)
+        {
+            i->publish();
+        }
+        for (auto &i : changes)
+        {
+            i->notify();
+        }
+    }
+
+    void ConfigWatcher::start()
+    {
+        if (m_fd < 0 || m_started.exchange(true))
+        {
+            return;
+        }
+        // 析构时detach
+        Thread([this]()
+               {
+                   while (true)
+                   {
+                       check(-1);
+                   } },
+               "config_watcher");
+    }
+
+    int ConfigWatcher::reloadLocked(File &file, vector<ConfigVarBase::Change::ptr> &output)
+    {
+        ifstream ifs(file.path);
+        if (!ifs)
+        {
+            JYL_LOG_ERROR(JYL_LOG_ROOT()) << "ConfigWatcher open " << file.path << " failed: " << strerror(errno);
+            return -1;
+        }
+        stringstream ss;
+        ss << ifs.rdbuf();
+        string content = ss.str();
+        if (content == file.content)
+        {
+            return 0;
+        }
+        YAML::Node root;
+        try
+        {
+            root = YAML::Load(content);
+        }
+        catch (exception &e)
+        {
+            JYL_LOG_ERROR(JYL_LOG_ROOT()) << "ConfigWatcher parse " << file.path << " failed: " << e.what();
+            return -1;
+        }
+
+        // 第一步：找出有对应配置项且内容变了的子树，全部解析好
+        vector<pair<ConfigVarBase::ptr, YAML::Node>> all_nodes;
+        Config::Collect(root, all_nodes);
+        map<string, YAML::Node> nodes;
+        vector<ConfigVarBase::Change::ptr> changes;
+        for (auto &i : all_nodes)
+        {
+            ConfigVarBase::ptr var = i.first;
+            const string &key = var->getName();
+            nodes[key] = i.second;
+            auto old = file.nodes.find(key);
+            if (old != file.nodes.end() && NodeEqual(old->second, i.second))
+            {
+                continue;
+            }
+            ConfigVarBase::Change::ptr change;
+            if (!var->prepare(i.second, change))
+            {
+                JYL_LOG_ERROR(JYL_LOG_ROOT()) << "ConfigWatcher " << file.path << ": invalid value for " << key
+                                              << ", nothing applied";
+                return -1;
+            }
+            if (change)
+            {
+                changes.push_back(change);
+            }
+        }
+
+        // 第二步：由调用方在m_mutex外生效和通知
+        output.insert(output.end(), changes.begin(), changes.end());
+        file.content.swap(content);
+        file.nodes.swap(nodes);
+        JYL_LOG_INFO(JYL_LOG_ROOT()) << "ConfigWatcher reload " << file.path << ": " << changes.size() << " changed";
+        return changes.size();
     }
-}
\ No newline at end of file
+}
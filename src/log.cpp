@@ -1,6 +1,19 @@
 #include "../include/log.h"
+#include "../include/config.h"
 #include <map>
 #include <functional>
+#include <fcntl.h>
+#include <string.h>
+#include <errno.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+#include <zlib.h>
+#include <algorithm>
+#include <cmath>
+#include <queue>
 
 namespace jyl
 {
@@ -23,146 +36,337 @@ namespace jyl
         }
     }
 
-    class MessageFormatItem : public LogFormatter::FormatItem
+    LogLevel::Level LogLevel::FromString(const string &str)
     {
-    public:
-        MessageFormatItem(const string &fmt = "m") {}
-        void format(ostream &os, shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event) override
-        {
-            os << event->getContent();
-        }
-    };
-    class LevelFormatItem : public LogFormatter::FormatItem
+        string v = str;
+        transform(v.begin(), v.end(), v.begin(), ::toupper);
+#define XX(name)            \
+    if (v == #name)         \
+    {                       \
+        return LogLevel::name; \
+    }
+        XX(DEBUG)
+        XX(INFO)
+        XX(WARN)
+        XX(ERROR)
+        XX(FATAL)
+        XX(OFF)
+#undef XX
+        return LogLevel::UNKNOWN;
+    }
+
+    LogStream &LogSample::note(LogStream &os) const
     {
-    public:
-        LevelFormatItem(const string &fmt) {}
-        void format(ostream &os, shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event) override
+        if (suppressed > 0)
         {
-            os << LogLevel::toString(level);
+            os << "[" << suppressed << " suppressed] ";
         }
-    };
-    class ElapseFormatItem : public LogFormatter::FormatItem
+        return os;
+    }
+
+    static void AppendUInt(string &out, uint64_t v)
     {
-    public:
-        ElapseFormatItem(const string &fmt) {}
-        void format(ostream &os, shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event) override
+        char buf[24];
+        char *p = buf + sizeof(buf);
+        do
         {
-            os << logger->getName();
-        }
-    };
-    class NameFormatItem : public LogFormatter::FormatItem
+            *--p = '0' + v % 10;
+            v /= 10;
+        } while (v);
+        out.append(p, buf + sizeof(buf) - p);
+    }
+
+    // 固定宽度，不足补0
+    static void AppendFixed(string &out, uint32_t v, int width)
     {
-    public:
-        NameFormatItem(const string &fmt) {}
-        void format(ostream &os, shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event) override
+        char buf[16];
+        for (int i = width - 1; i >= 0; --i)
         {
-            os << event->getLogger()->getName();
+            buf[i] = '0' + v % 10;
+            v /= 10;
         }
-    };
-    class ThreadIdFormatItem : public LogFormatter::FormatItem
+        out.append(buf, width);
+    }
+
+    static void AppendInt(string &out, int64_t v)
     {
-    public:
-        ThreadIdFormatItem(const string &fmt) {}
-        void format(ostream &os, shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event) override
+        if (v < 0)
         {
-            os << event->getThreadID();
+            out.append(1, '-');
+            AppendUInt(out, -(uint64_t)v);
         }
-    };
-    class FiberIdFormatItem : public LogFormatter::FormatItem
-    {
-    public:
-        FiberIdFormatItem(const string &fmt) {}
-        void format(ostream &os, shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event) override
+        else
         {
-            os << event->getFiberID();
+            AppendUInt(out, v);
         }
-    };
-    class DateTimeFormatItem : public LogFormatter::FormatItem
+    }
+
+    // 加上引号，按JSON转义；UTF-8的多字节字符原样输出
+    static void AppendJsonString(string &out, const char *data, size_t len)
     {
-    public:
-        DateTimeFormatItem(const std::string &format = "%Y-%m-%d %H:%M:%S")
-            : m_format(format)
+        static const char kHex[] = "0123456789abcdef";
+        out.append(1, '"');
+        const char *begin = data;
+        const char *end = data + len;
+        for (const char *p = data; p != end; ++p)
         {
-            if (m_format.empty())
+            unsigned char c = *p;
+            if (c >= 0x20 && c != '"' && c != '\\')
+            {
+                continue;
+            }
+            out.append(begin, p - begin);
+            begin = p + 1;
+            switch (c)
             {
-                m_format = "%Y-%m-%d %H:%M:%S";
+            case '"':
+                out.append("\\\"");
+                break;
+            case '\\':
+                out.append("\\\\");
+                break;
+            case '\n':
+                out.append("\\n");
+                break;
+            case '\r':
+                out.append("\\r");
+                break;
+            case '\t':
+                out.append("\\t");
+                break;
+            default:
+                out.append("\\u00");
+                out.append(1, kHex[c >> 4]);
+                out.append(1, kHex[c & 0xf]);
+                break;
             }
         }
+        out.append(begin, end - begin);
+        out.append(1, '"');
+    }
 
-        void format(std::ostream &os, Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event) override
+    // JSON里没有NaN和无穷大，输出null
+    static void AppendJsonDouble(string &out, double v)
+    {
+        if (!isfinite(v))
         {
-            struct tm tm;
-            time_t time = event->getTime();
-            localtime_r(&time, &tm);
-            char buf[64];
-            strftime(buf, sizeof(buf), m_format.c_str(), &tm);
-            os << buf;
+            out.append("null");
+            return;
+        }
+        // 整数值不走snprintf；其它用17位有效数字，保证能精确还原
+        if (fabs(v) < 1e15 && v == (double)(int64_t)v)
+        {
+            AppendInt(out, (int64_t)v);
+            return;
         }
+        char buf[32];
+        int n = snprintf(buf, sizeof(buf), "%.17g", v);
+        out.append(buf, n);
+    }
 
-    private:
-        string m_format;
-    };
-    class LineFormatItem : public LogFormatter::FormatItem
+    // key=value，字符串里有空白、控制字符、引号、等号或为空时加引号
+    static void AppendFieldsText(string &out, const LogFields &fields)
     {
-    public:
-        LineFormatItem(const string &fmt) {}
-        void format(ostream &os, shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event) override
+        for (size_t i = 0; i < fields.size(); ++i)
         {
-            os << event->getLine();
+            const LogFields::Field &f = fields[i];
+            if (i > 0)
+            {
+                out.append(1, ' ');
+            }
+            out.append(fields.key(f), f.keyLen);
+            out.append(1, '=');
+            switch (f.type)
+            {
+            case LogFields::INT:
+                AppendInt(out, f.i);
+                break;
+            case LogFields::UINT:
+                AppendUInt(out, f.u);
+                break;
+            case LogFields::DOUBLE:
+            {
+                char buf[32];
+                int n = snprintf(buf, sizeof(buf), "%g", f.d);
+                out.append(buf, n);
+                break;
+            }
+            case LogFields::BOOL:
+                out.append(f.b ? "true" : "false");
+                break;
+            case LogFields::STRING:
+            {
+                const char *str = fields.str(f);
+                bool quote = f.s.len == 0;
+                for (uint32_t n = 0; n < f.s.len && !quote; ++n)
+                {
+                    quote = (unsigned char)str[n] <= ' ' || str[n] == '"' || str[n] == '=';
+                }
+                if (quote)
+                {
+                    AppendJsonString(out, str, f.s.len);
+                }
+                else
+                {
+                    out.append(str, f.s.len);
+                }
+                break;
+            }
+            }
         }
-    };
-    class NewLineFormatItem : public LogFormatter::FormatItem
+    }
+
+    static atomic<uint32_t> s_loggerId{0};
+    static atomic<uint64_t> s_appendersVersion{0};
+
+    Logger::Logger(const string &name)
+        : m_name(name), m_id(s_loggerId++), m_level(LogLevel::DEBUG), m_appendersVersion(++s_appendersVersion)
     {
-    public:
-        NewLineFormatItem(const string &fmt) {}
-        void format(ostream &os, shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event) override
+        m_formatter.store(make_shared<const LogFormatter::ptr>(new LogFormatter("%d{%Y-%m-%d %H:%M:%S}%T%t%T%F%T[%p]%T%f:%l%T%m%n")));
+    }
+
+    LogStream &LogStream::appendInt(long long v)
+    {
+        char buf[24];
+        int n = snprintf(buf, sizeof(buf), "%lld", v);
+        m_buf.append(buf, n);
+        return *this;
+    }
+
+    LogStream &LogStream::appendUInt(unsigned long long v)
+    {
+        char buf[24];
+        char *p = buf + sizeof(buf);
+        do
         {
-            os << endl;
-        }
-    };
-    class FileFormatItem : public LogFormatter::FormatItem
+            *--p = '0' + v % 10;
+            v /= 10;
+        } while (v);
+        m_buf.append(p, buf + sizeof(buf) - p);
+        return *this;
+    }
+
+    LogStream &LogStream::appendDouble(double v)
     {
-    public:
-        FileFormatItem(const string &fmt) {}
-        void format(ostream &os, shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event) override
+        // 和iostream默认的输出一致
+        char buf[32];
+        int n = snprintf(buf, sizeof(buf), "%g", v);
+        m_buf.append(buf, n);
+        return *this;
+    }
+
+    LogStream &LogStream::vappend(const char *fmt, va_list al)
+    {
+        size_t old = m_buf.size();
+        size_t avail = max(m_buf.capacity() - old, (size_t)128);
+        va_list copy;
+        va_copy(copy, al);
+        m_buf.resize(old + avail);
+        int len = vsnprintf(&m_buf[old], avail + 1, fmt, al);
+        if (len > (int)avail)
         {
-            os << event->getFile();
+            m_buf.resize(old + len);
+            vsnprintf(&m_buf[old], len + 1, fmt, copy);
         }
-    };
-    class StringFormatItem : public LogFormatter::FormatItem
+        va_end(copy);
+        m_buf.resize(old + max(len, 0));
+        return *this;
+    }
+
+    LogStream &LogStream::operator<<(const void *v)
     {
-    public:
-        StringFormatItem(const string &str = "") : FormatItem(str), m_string(str) {}
-        void format(ostream &os, shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event) override
+        if (!v)
         {
-            os << m_string;
+            m_buf.append(1, '0');
+            return *this;
         }
+        char buf[24];
+        int n = snprintf(buf, sizeof(buf), "%p", v);
+        m_buf.append(buf, n);
+        return *this;
+    }
 
-    private:
-        string m_string;
-    };
-
-    class TabFormatItem : public LogFormatter::FormatItem
+    LogStream &LogStream::operator<<(ostream &(*pf)(ostream &))
     {
-    public:
-        TabFormatItem(const string &str = "") {}
-        void format(ostream &os, shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event) override
+        if (pf == static_cast<ostream &(*)(ostream &)>(endl))
         {
-            os << '\t';
+            m_buf.append(1, '\n');
         }
-    };
+        return *this;
+    }
 
-    Logger::Logger(const string &name)
-        : m_name(name), m_level(LogLevel::DEBUG)
+    LogEvent::LogEvent(shared_ptr<Logger> logger, LogLevel::Level level, const char *file, int32_t m_line, uint32_t elapse, uint32_t thread_id, uint32_t fiber_id, uint64_t time_us)
+        : m_file(file), m_line(m_line), m_threadID(thread_id), m_fiberID(fiber_id), m_elapsed(elapse), m_time(time_us), m_logger(logger), m_level(level)
+    {
+        // cout << "logevent" << endl;
+        memcpy(m_threadName, Thread::GetName(), sizeof(m_threadName));
+        m_ss.setFields(&m_fields);
+    }
+
+    void LogEvent::reset(shared_ptr<Logger> logger, LogLevel::Level level, const char *file, int32_t line, uint32_t elapse, uint32_t thread_id, uint32_t fiber_id, uint64_t time_us)
     {
-        m_formatter.reset(new LogFormatter("%d{%Y-%m-%d %H:%M:%S}%T%t%T%F%T[%p]%T%f:%l%T%m%n"));
+        m_file = file;
+        m_line = line;
+        m_threadID = thread_id;
+        memcpy(m_threadName, Thread::GetName(), sizeof(m_threadName));
+        m_fiberID = fiber_id;
+        m_elapsed = elapse;
+        m_time = time_us;
+        m_ss.clear();
+        m_fields.clear();
+        m_logger = move(logger);
+        m_level = level;
     }
 
-    LogEvent::LogEvent(shared_ptr<Logger> logger, LogLevel::Level level, const char *file, int32_t m_line, uint32_t elapse, uint32_t thread_id, uint32_t fiber_id, uint32_t time)
-        : m_file(file), m_line(m_line), m_elapsed(elapse), m_threadID(thread_id), m_fiberID(fiber_id), m_time(time), m_logger(logger), m_level(level)
+    void LogEvent::assign(const LogEvent &other)
     {
-        // cout << "logevent" << endl;
+        m_file = other.m_file;
+        m_line = other.m_line;
+        m_threadID = other.m_threadID;
+        memcpy(m_threadName, other.m_threadName, sizeof(m_threadName));
+        m_fiberID = other.m_fiberID;
+        m_elapsed = other.m_elapsed;
+        m_time = other.m_time;
+        m_ss.clear();
+        m_ss << other.getContent();
+        m_fields = other.m_fields;
+        m_logger = other.m_logger;
+        m_level = other.m_level;
+    }
+
+    void LogEvent::setThreadName(const char *name)
+    {
+        strncpy(m_threadName, name, sizeof(m_threadName) - 1);
+        m_threadName[sizeof(m_threadName) - 1] = '\0';
+    }
+
+    LogEvent::ptr LogEvent::Acquire(shared_ptr<Logger> logger, LogLevel::Level level, const char *file, int32_t line, uint32_t elapse, uint32_t thread_id, uint32_t fiber_id, uint64_t time_us)
+    {
+        // 只有池子自己持有的事件才能复用，异步appender队列里的还在用。
+        // 从上次的位置往后找，异步队列按顺序消费，最早放出去的最先空闲
+        static const size_t kPoolSize = 32;
+        static thread_local LogEvent::ptr t_pool[kPoolSize];
+        static thread_local size_t t_next = 0;
+        for (size_t n = 0; n < kPoolSize; ++n)
+        {
+            LogEvent::ptr &event = t_pool[t_next];
+            t_next = (t_next + 1) % kPoolSize;
+            if (!event)
+            {
+                event = make_shared<LogEvent>(logger, level, file, line, elapse, thread_id, fiber_id, time_us);
+                return event;
+            }
+            if (event.use_count() == 1)
+            {
+                // 和其它线程释放引用时的写操作同步
+                atomic_thread_fence(memory_order_acquire);
+                event->reset(logger, level, file, line, elapse, thread_id, fiber_id, time_us);
+                return event;
+            }
+        }
+        return make_shared<LogEvent>(logger, level, file, line, elapse, thread_id, fiber_id, time_us);
     }
+
     LogEvent::~LogEvent()
     {
     }
@@ -175,13 +379,7 @@ namespace jyl
     }
     void LogEvent::format(const char *fmt, va_list al)
     {
-        char *buf = nullptr;
-        int len = vasprintf(&buf, fmt, al);
-        if (len != -1)
-        {
-            m_ss << string(buf, len);
-            free(buf);
-        }
+        m_ss.vappend(fmt, al);
     }
     LogEventWrap::LogEventWrap(LogEvent::ptr event) : m_event(event)
     {
@@ -193,251 +391,2577 @@ namespace jyl
     }
     // LogEvent::ptr LogEventWrap::getEvent() const { return m_event; }
 
-    stringstream &LogEventWrap::getSS() { return m_event->getSS(); }
+    LogStream &LogEventWrap::getSS() { return m_event->getSS(); }
 
     void Logger::addAppender(LogAppender::ptr appender)
     {
-        if (!appender->getFormatter())
+        if (!appender->hasFormatter())
         {
-            appender->setFormatter(m_formatter);
+            appender->setFormatter(getFormatter());
         }
-        m_appenderList.push_back(appender);
+        m_appenders.update([&appender](vector<LogAppender::ptr> &appenders)
+                           { appenders.push_back(appender); });
+        m_appendersVersion.store(++s_appendersVersion, memory_order_release);
     }
 
     void Logger::delAppender(LogAppender::ptr appender)
     {
-        for (auto it = m_appenderList.begin(); it != m_appenderList.end(); ++it)
-        {
-            if (*it == appender)
-            {
-                m_appenderList.erase(it);
-                break;
-            }
-        }
+        m_appenders.update([&appender](vector<LogAppender::ptr> &appenders)
+                           {
+                               auto it = find(appenders.begin(), appenders.end(), appender);
+                               if (it != appenders.end())
+                               {
+                                   appenders.erase(it);
+                               } });
+        m_appendersVersion.store(++s_appendersVersion, memory_order_release);
     }
 
-    void Logger::log(LogLevel::Level level, LogEvent::ptr event)
+    void Logger::clearAppenders()
     {
-        auto self = shared_from_this();
-        if (level >= m_level)
-        {
-            if (!m_appenderList.empty())
-            {
-                for (auto &i : m_appenderList)
-                {
-                    i->log(self, level, event);
-                }
-            }
-            else if (m_root)
-            {
-                m_root->log(level, event);
-            }
-        }
+        m_appenders.store(make_shared<const vector<LogAppender::ptr>>());
+        m_appendersVersion.store(++s_appendersVersion, memory_order_release);
     }
-    void Logger::debug(LogEvent::ptr event) { log(LogLevel::DEBUG, event); }
-    void Logger::info(LogEvent::ptr event) { log(LogLevel::INFO, event); }
-    void Logger::warn(LogEvent::ptr event) { log(LogLevel::WARN, event); }
-    void Logger::error(LogEvent::ptr event) { log(LogLevel::ERROR, event); }
-    void Logger::fatal(LogEvent::ptr event) { log(LogLevel::FATAL, event); }
 
-    FileLogAppender::FileLogAppender(const string &filename) : m_filename(filename)
+    void Logger::setFormatter(LogFormatter::ptr formatter)
     {
+        // 在写者锁里换掉appender的格式器，并发的setFormatter不会交错
+        m_formatter.update([&](LogFormatter::ptr &current)
+                           {
+                               LogFormatter::ptr old = current;
+                               current = formatter;
+                               m_appenders.read([&](const vector<LogAppender::ptr> &appenders)
+                                                {
+                                                    for (auto &i : appenders)
+                                                    {
+                                                        if (i->getFormatter() == old)
+                                                        {
+                                                            i->setFormatter(formatter);
+                                                        }
+                                                    } }); });
     }
-    void FileLogAppender::log(shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event)
+
+    bool Logger::setFormatter(const string &pattern)
     {
-        if (level >= m_level)
+        LogFormatter::ptr formatter(new LogFormatter(pattern));
+        if (formatter->isError())
         {
-            reopen();
-            m_fileStream << m_formatter->format(logger, level, event) << endl;
-            m_fileStream.flush();
+            std::cout << "Logger setFormatter name=" << m_name << " invalid pattern: " << pattern << std::endl;
+            return false;
         }
+        setFormatter(formatter);
+        return true;
     }
-    bool FileLogAppender::reopen()
+
+    void Logger::setRateLimit(uint32_t rate, uint32_t burst)
     {
-        if (m_fileStream.is_open())
-        {
-            m_fileStream.close();
-        }
-        m_fileStream.open(m_filename);
-        return !m_fileStream.fail();
+        uint64_t interval = rate ? 1000000000ull / rate : 0;
+        m_rateTolerance.store(interval * (max(burst, 1u) - 1), memory_order_relaxed);
+        m_rateInterval.store(interval, memory_order_relaxed);
     }
 
-    void StdoutLogAppender::log(shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event)
+    // appender格式化用的线程缓存，避免每条日志分配内存
+    static thread_local string t_formatBuffer;
+
+    // 一次分发内的格式化结果，按(事件, 格式器, 级别)查找，最外层分发结束时清空
+    struct FormatMemo
     {
-        if (level >= m_level)
+        static const int kSlots = 4;
+        struct Slot
         {
-            cout << m_formatter->format(logger, level, event) << endl;
-        }
-    }
+            const LogEvent *event = nullptr;
+            LogFormatter::ptr formatter; // 持有格式器，避免被换掉后地址被复用
+            LogLevel::Level level = LogLevel::UNKNOWN;
+            string out;
+        };
 
-    LogFormatter::LogFormatter(const string &pattern) : m_pattern(pattern) { init(); }
+        int depth = 0; // 正在进行的Logger::dispatch层数
+        int used = 0;
+        Slot slots[kSlots];
+    };
+    static thread_local FormatMemo t_formatMemo;
 
-    void LogFormatter::init()
+    detail::FormatMemoScope::FormatMemoScope() { ++t_formatMemo.depth; }
+
+    detail::FormatMemoScope::~FormatMemoScope()
     {
-        vector<tuple<string, string, int>> vec;
-        string nstr;
-        for (size_t i = 0; i < m_pattern.size(); ++i)
+        FormatMemo &memo = t_formatMemo;
+        if (--memo.depth == 0)
         {
-            if (m_pattern[i] != '%')
+            for (int i = 0; i < memo.used; ++i)
             {
-                nstr.append(1, m_pattern[i]);
-                continue;
+                memo.slots[i].event = nullptr;
+                memo.slots[i].formatter.reset();
             }
-            size_t n = i + 1;
-            int fmt_status = 0;
-            size_t fmt_begin = 0;
-            string str;
-            string fmt;
-            while (n < m_pattern.size())
-            {
-                if (!fmt_status && (!isalpha(m_pattern[n]) && m_pattern[n] != '{' && m_pattern[n] != '}'))
-                {
-                    str = m_pattern.substr(i + 1, n - i - 1);
-                    break;
-                }
+            memo.used = 0;
+        }
+    }
 
-                if (fmt_status == 0)
-                {
-                    if (m_pattern[n] == '{')
-                    {
-                        str = m_pattern.substr(i + 1, n - i - 1);
-                        fmt_status = 1; // 解析格式
-                        fmt_begin = n;
-                        ++n;
-                        continue;
-                    }
-                }
-                if (fmt_status == 1)
-                {
-                    if (m_pattern[n] == '}')
-                    {
-                        fmt = m_pattern.substr(fmt_begin + 1, n - fmt_begin - 1);
-                        fmt_status = 0;
-                        ++n;
-                        break;
-                    }
-                }
-                ++n;
-                if (n == m_pattern.size())
-                {
-                    if (str.empty())
-                    {
-                        str = m_pattern.substr(i + 1);
-                    }
-                }
-            }
-            if (fmt_status == 0)
+    const string &LogAppender::formatEvent(Logger *logger, LogLevel::Level level, const LogEvent &event)
+    {
+        FormatMemo &memo = t_formatMemo;
+        // 格式器可能被其它线程换掉，用到的这个在返回前不会释放
+        Snapshot<LogFormatter::ptr>::Ref formatter = m_formatter.ref();
+        if (memo.depth > 0)
+        {
+            LogFormatter *fmt = formatter->get();
+            for (int i = 0; i < memo.used; ++i)
             {
-                if (!nstr.empty())
+                FormatMemo::Slot &slot = memo.slots[i];
+                if (slot.event == &event && slot.formatter.get() == fmt && slot.level == level)
                 {
-                    vec.push_back(make_tuple(nstr, string(), 0));
-                    nstr.clear();
+                    return slot.out;
                 }
-                vec.push_back(make_tuple(str, fmt, 1));
-                i = n - 1;
             }
-            else if (fmt_status == 1)
+            // 槽用完时不缓存，已有的结果可能还在被外层使用
+            if (memo.used < FormatMemo::kSlots)
             {
-                std::cout << "pattern parse error: " << m_pattern << " - " << m_pattern.substr(i) << std::endl;
-                m_error = true;
-                vec.push_back(std::make_tuple("<<pattern_error>>", fmt, 0));
+                FormatMemo::Slot &slot = memo.slots[memo.used++];
+                slot.event = &event;
+                slot.formatter = *formatter;
+                slot.level = level;
+                slot.out.clear();
+                slot.formatter->format(slot.out, logger, level, event);
+                return slot.out;
             }
         }
+        string &str = t_formatBuffer;
+        str.clear();
+        (*formatter)->format(str, logger, level, event);
+        return str;
+    }
 
-        if (!nstr.empty())
+    // GCRA：每条日志把理论到达时间往后推一个间隔，超前当前时间太多就丢弃
+    bool Logger::rateAllow(LogLevel::Level level)
+    {
+        uint64_t interval = m_rateInterval.load(memory_order_relaxed);
+        if (interval == 0 || level >= LogLevel::ERROR)
         {
-            vec.push_back(make_tuple(nstr, string(), 0));
+            return true;
         }
-
-        /*
-            %m 消息体
-            %p level
-            %r 启动后的时间
-            %c 日志名称
-            %n 回车换行
-            %d 时间
-            %f 文件名
-            %l 行号
-        */
-        static map<string, function<LogFormatter::FormatItem::ptr(const string &str)>> s_format_items = {
-#define XX(str, C)                                                                       \
-    {                                                                                    \
-        str, [](const string &fmt) { return LogFormatter::FormatItem::ptr(new C(fmt)); } \
-    }
-            XX("m", MessageFormatItem),
-            XX("p", LevelFormatItem),
-            XX("r", ElapseFormatItem),
-            XX("c", NameFormatItem),
-            XX("t", ThreadIdFormatItem),
-            XX("n", NewLineFormatItem),
-            XX("d", DateTimeFormatItem),
-            XX("f", FileFormatItem),
-            XX("l", LineFormatItem),
-            XX("T", TabFormatItem),
-            XX("F", FiberIdFormatItem)
-#undef XX
-        };
-        for (auto &i : vec)
+        uint64_t now = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+        uint64_t tolerance = m_rateTolerance.load(memory_order_relaxed);
+        uint64_t tat = m_rateTat.load(memory_order_relaxed);
+        while (true)
         {
-            if (get<2>(i) == 0)
+            uint64_t start = max(tat, now);
+            if (start - now > tolerance)
             {
-                m_items.push_back(FormatItem::ptr(new StringFormatItem(get<0>(i))));
+                m_rateDropped.fetch_add(1, memory_order_relaxed);
+                m_rateDroppedTotal.fetch_add(1, memory_order_relaxed);
+                return false;
             }
-            else
+            if (m_rateTat.compare_exchange_weak(tat, start + interval, memory_order_relaxed))
             {
-                auto it = s_format_items.find(get<0>(i));
-                if (it == s_format_items.end())
-                {
-                    m_items.push_back(FormatItem::ptr(new StringFormatItem("<<error_format %" + get<0>(i) + ">>")));
-                    m_error = true;
-                }
-                else
-                {
-                    m_items.push_back(it->second(get<1>(i)));
-                }
+                return true;
             }
-            // std::cout << "(" << std::get<0>(i) << ") - (" << std::get<1>(i) << ") - (" << std::get<2>(i) << ")" << std::endl;
         }
     }
 
-    string LogFormatter::format(shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event)
+    LogEvent::ptr Logger::takeRateNote(const char *file, int32_t line, uint32_t elapse, uint32_t thread_id,
+                                       uint32_t fiber_id, uint64_t time_us)
     {
-        std::stringstream ss;
-        for (auto &i : m_items)
+        if (m_rateDropped.load(memory_order_relaxed) == 0)
+        {
+            return nullptr;
+        }
+        uint64_t dropped = m_rateDropped.exchange(0, memory_order_relaxed);
+        if (dropped == 0)
         {
-            i->format(ss, logger, level, event);
+            return nullptr;
         }
-        return ss.str();
+        LogEvent::ptr note = LogEvent::Acquire(shared_from_this(), LogLevel::WARN, file, line, elapse, thread_id, fiber_id, time_us);
+        note->getSS() << "rate limit: " << dropped << " log events dropped";
+        return note;
     }
 
-    LoggerManager::LoggerManager()
+    void Logger::log(LogLevel::Level level, LogEvent::ptr event)
     {
-        m_root.reset(new Logger);
-        m_root->addAppender(LogAppender::ptr(new StdoutLogAppender));
-        m_loggers[m_root->m_name] = m_root;
-        init();
+        if (level >= m_level && !dispatch(level, event) && m_root)
+        {
+            m_root->log(level, event);
+        }
     }
 
-    Logger::ptr LoggerManager::getLogger(const string &name)
+    // 限流算在真正输出的logger上：自己没有appender时不计数，交给root按root的级别和限流处理。
+    // appender集合的hazard槽在整个分发期间占用，formatEvent读格式器时再占一个。嵌套的分发
+    // (比如appender里又写日志)把每个线程的8个槽用完后，Ref改为持有引用计数，只是变慢
+    bool Logger::dispatch(LogLevel::Level level, const LogEvent::ptr &event)
     {
-        auto it = m_loggers.find(name);
-        if (it != m_loggers.end())
+        detail::FormatMemoScope memo;
+        return m_appenders.read([&](const vector<LogAppender::ptr> &appenders)
+                                {
+                                    if (appenders.empty())
+                                    {
+                                        return false;
+                                    }
+                                    if (!rateAllow(level))
+                                    {
+                                        return true;
+                                    }
+                                    auto self = shared_from_this();
+                                    LogEvent::ptr note = takeRateNote(event->getFile(), event->getLine(), event->getElapsed(),
+                                                                      event->getThreadID(), event->getFiberID(), event->getTimeUS());
+                                    for (auto &i : appenders)
+                                    {
+                                        if (note)
+                                        {
+                                            i->log(self, LogLevel::WARN, note);
+                                        }
+                                        i->log(self, level, event);
+                                    }
+                                    return true; });
+    }
+
+    void Logger::debug(LogEvent::ptr event) { log(LogLevel::DEBUG, event); }
+    void Logger::info(LogEvent::ptr event) { log(LogLevel::INFO, event); }
+    void Logger::warn(LogEvent::ptr event) { log(LogLevel::WARN, event); }
+    void Logger::error(LogEvent::ptr event) { log(LogLevel::ERROR, event); }
+    void Logger::fatal(LogEvent::ptr event) { log(LogLevel::FATAL, event); }
+
+    // 完整写入，处理EINTR和部分写。written不为空时返回失败前已经写出的字节数
+    static bool WriteAll(int fd, const char *data, size_t len, size_t *written = nullptr)
+    {
+        size_t total = len;
+        while (len > 0)
+        {
+            ssize_t n = ::write(fd, data, len);
+            if (n < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                break;
+            }
+            data += n;
+            len -= n;
+        }
+        if (written)
+        {
+            *written = total - len;
+        }
+        return len == 0;
+    }
+
+    // 后台定时刷新带缓存的appender，进程退出时不析构，避免和其它静态对象的析构顺序冲突
+    class LogFlusher
+    {
+    public:
+        static LogFlusher *GetInstance()
+        {
+            static LogFlusher *s_flusher = new LogFlusher;
+            return s_flusher;
+        }
+
+        void add(LogAppender *appender, uint32_t interval)
+        {
+            lock_guard<mutex> lock(m_mutex);
+            m_appenders[appender] = make_pair(max(interval, 1u), getCurrentMS() + interval);
+        }
+        // 返回后flush和该appender投递的任务都不会再被调用
+        void del(LogAppender *appender)
+        {
+            lock_guard<mutex> lock(m_mutex);
+            m_appenders.erase(appender);
+            lock_guard<mutex> task_lock(m_taskMutex);
+            for (auto it = m_tasks.begin(); it != m_tasks.end();)
+            {
+                it = it->first == appender ? m_tasks.erase(it) : ++it;
+            }
+        }
+        // 在后台线程执行cb，可以在持有appender锁时调用
+        void post(LogAppender *appender, function<void()> cb)
+        {
+            {
+                lock_guard<mutex> lock(m_taskMutex);
+                m_tasks.push_back(make_pair(appender, cb));
+            }
+            m_cond.notify_one();
+        }
+
+    private:
+        LogFlusher()
+        {
+            // 析构时detach
+            Thread(bind(&LogFlusher::run, this), "log_flusher");
+        }
+        void run()
+        {
+            unique_lock<mutex> lock(m_mutex);
+            while (true)
+            {
+                m_cond.wait_for(lock, chrono::milliseconds(50));
+                list<pair<LogAppender *, function<void()>>> tasks;
+                {
+                    lock_guard<mutex> task_lock(m_taskMutex);
+                    tasks.swap(m_tasks);
+                }
+                for (auto &i : tasks)
+                {
+                    i.second();
+                }
+                uint64_t now = getCurrentMS();
+                for (auto &i : m_appenders)
+                {
+                    if (now >= i.second.second)
+                    {
+                        i.first->flush();
+                        i.second.second = now + i.second.first;
+                    }
+                }
+            }
+        }
+
+    private:
+        mutex m_mutex;
+        condition_variable m_cond;
+        map<LogAppender *, pair<uint32_t, uint64_t>> m_appenders; // appender -> (间隔, 下次刷新时间)
+        mutex m_taskMutex;
+        list<pair<LogAppender *, function<void()>>> m_tasks;
+    };
+
+    static atomic<uint32_t> s_reopenGen{0};
+
+    FileLogAppender::FileLogAppender(const string &filename, size_t buffer_size, uint32_t flush_interval)
+        : FileLogAppender(filename, buffer_size, flush_interval, true)
+    {
+    }
+
+    FileLogAppender::FileLogAppender(const string &filename, size_t buffer_size, uint32_t flush_interval, bool attach)
+        : m_filename(filename), m_bufferSize(buffer_size), m_flushInterval(flush_interval),
+          m_reopenGen(s_reopenGen.load())
+    {
+        m_buffer.reserve(m_bufferSize + 4096);
+        m_lastFlush = getCurrentMS();
+        openLocked();
+        if (attach)
+        {
+            attachFlusher();
+        }
+    }
+
+    FileLogAppender::~FileLogAppender()
+    {
+        detachFlusher();
+        lock_guard<mutex> lock(m_mutex);
+        flushLocked();
+        if (m_fd >= 0)
+        {
+            ::close(m_fd);
+        }
+        if (m_indexFd >= 0)
+        {
+            closeBlockLocked(m_fileSize);
+            writeIndexLocked();
+            ::close(m_indexFd);
+        }
+    }
+
+    void FileLogAppender::attachFlusher()
+    {
+        LogFlusher::GetInstance()->add(this, m_flushInterval);
+    }
+
+    void FileLogAppender::detachFlusher()
+    {
+        LogFlusher::GetInstance()->del(this);
+    }
+
+    void FileLogAppender::log(shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event)
+    {
+        if (level >= m_level)
+        {
+            const string &str = formatEvent(logger.get(), level, *event);
+            lock_guard<mutex> lock(m_mutex);
+            beforeAppendLocked();
+            m_buffer.append(str);
+            m_buffer.append(1, '\n');
+            if (m_indexFd >= 0)
+            {
+                uint64_t time_us = event->getTimeUS();
+                ++m_block.count;
+                m_block.minTime = min(m_block.minTime, time_us);
+                m_block.maxTime = max(m_block.maxTime, time_us);
+                m_block.levels |= 1u << level;
+                uint64_t end = m_fileSize + m_buffer.size();
+                if (end - m_block.offset >= m_indexBlock)
+                {
+                    closeBlockLocked(end);
+                }
+            }
+            afterAppendLocked(level);
+        }
+    }
+
+    void FileLogAppender::beforeAppendLocked()
+    {
+        if (m_reopenGen != s_reopenGen.load(memory_order_relaxed))
+        {
+            m_reopenGen = s_reopenGen.load();
+            flushLocked();
+            openLocked();
+        }
+    }
+
+    void FileLogAppender::afterAppendLocked(LogLevel::Level level)
+    {
+        // 错误日志立即落盘；缓存加上已写的内容到了max_size也马上写出，让后台尽早切分，文件不会超出太多
+        if (m_buffer.size() >= m_bufferSize || level >= LogLevel::ERROR || getCurrentMS() - m_lastFlush >= m_flushInterval ||
+            (!m_rotating && m_maxSize && m_fileSize + m_buffer.size() >= m_maxSize))
+        {
+            flushLocked();
+        }
+    }
+
+    void FileLogAppender::flush()
+    {
+        lock_guard<mutex> lock(m_mutex);
+        flushLocked();
+    }
+
+    bool FileLogAppender::flushLocked()
+    {
+        m_lastFlush = getCurrentMS();
+        if (m_buffer.empty())
+        {
+            return true;
+        }
+        if (m_fd < 0 && !openLocked())
+        {
+            // 打不开就丢掉，避免缓存无限增长
+            if (m_buffer.size() >= m_bufferSize)
+            {
+                m_dropped.fetch_add(m_buffer.size(), memory_order_relaxed);
+                m_buffer.clear();
+                m_indexBuffer.clear();
+                closeBlockLocked(m_fileSize);
+            }
+            return false;
+        }
+        size_t written = 0;
+        bool rt = WriteAll(m_fd, m_buffer.data(), m_buffer.size(), &written);
+        m_fileSize += written;
+        if (!rt)
+        {
+            // 没写出去的部分丢掉，文件大小和索引只算实际写出的
+            errorLocked("write log file error: ", m_filename);
+            m_dropped.fetch_add(m_buffer.size() - written, memory_order_relaxed);
+            trimIndexLocked();
+        }
+        else
+        {
+            m_failing = false;
+            if (m_fsync)
+            {
+                fdatasync(m_fd);
+            }
+        }
+        m_buffer.clear();
+        writeIndexLocked();
+        if (!m_rotating && ((m_maxSize && m_fileSize >= m_maxSize) || (m_period != NONE && time(0) >= m_periodEnd)))
+        {
+            // 改名和打开新文件在后台线程里做，新文件打开之前继续写旧的fd
+            m_rotating = true;
+            LogFlusher::GetInstance()->post(this, bind(&FileLogAppender::rotate, this));
+        }
+        return rt;
+    }
+
+    bool FileLogAppender::openLocked()
+    {
+        if (m_fd >= 0)
+        {
+            if (m_indexFd >= 0)
+            {
+                closeBlockLocked(m_fileSize);
+                writeIndexLocked();
+            }
+            ::close(m_fd);
+        }
+        m_fd = ::open(m_filename.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        if (m_fd < 0)
+        {
+            errorLocked("open log file error: ", m_filename);
+            return false;
+        }
+        struct stat st;
+        m_fileSize = fstat(m_fd, &st) == 0 ? st.st_size : 0;
+        m_openTime = m_fileSize > 0 ? st.st_mtime : time(0);
+        openIndexLocked();
+        onFileOpened();
+        return true;
+    }
+
+    const char FileLogAppender::kIndexMagic[8] = {'J', 'Y', 'L', 'L', 'I', 'D', 'X', '\0'};
+
+    void FileLogAppender::setIndex(bool v, uint32_t block_size)
+    {
+        lock_guard<mutex> lock(m_mutex);
+        m_indexBlock = max(block_size, 4096u);
+        if (v == m_index)
+        {
+            return;
+        }
+        flushLocked();
+        if (m_indexFd >= 0)
+        {
+            closeBlockLocked(m_fileSize);
+            writeIndexLocked();
+        }
+        m_index = v;
+        openIndexLocked();
+    }
+
+    void FileLogAppender::openIndexLocked()
+    {
+        if (m_indexFd >= 0)
+        {
+            ::close(m_indexFd);
+            m_indexFd = -1;
+        }
+        m_indexBuffer.clear();
+        if (!m_index)
+        {
+            return;
+        }
+        string name = m_filename + ".idx";
+        m_indexFd = ::open(name.c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        if (m_indexFd < 0)
+        {
+            errorLocked("open log index error: ", name);
+            return;
+        }
+        // 接着已有的索引写，文件头不对或者日志文件比索引短(被截断过)就重建
+        const size_t header = sizeof(kIndexMagic) + sizeof(kIndexVersion);
+        uint64_t indexed = 0; // 已有索引覆盖到的位置
+        struct stat st;
+        char magic[sizeof(kIndexMagic)];
+        uint32_t version = 0;
+        bool valid = fstat(m_indexFd, &st) == 0 && (size_t)st.st_size >= header &&
+                     pread(m_indexFd, magic, sizeof(magic), 0) == sizeof(magic) &&
+                     memcmp(magic, kIndexMagic, sizeof(magic)) == 0 &&
+                     pread(m_indexFd, &version, sizeof(version), sizeof(magic)) == sizeof(version) &&
+                     version == kIndexVersion;
+        if (valid)
+        {
+            size_t n = (st.st_size - header) / sizeof(LogIndexEntry);
+            LogIndexEntry last;
+            if (n > 0 && pread(m_indexFd, &last, sizeof(last), header + (n - 1) * sizeof(last)) == sizeof(last))
+            {
+                indexed = last.offset + last.length;
+            }
+            valid = indexed <= m_fileSize;
+            if (valid && (size_t)st.st_size != header + n * sizeof(LogIndexEntry) &&
+                ftruncate(m_indexFd, header + n * sizeof(LogIndexEntry)) != 0)
+            {
+                valid = false;
+            }
+        }
+        if (!valid)
+        {
+            indexed = 0;
+            if (ftruncate(m_indexFd, 0) != 0)
+            {
+                errorLocked("truncate log index error: ", name);
+            }
+            version = kIndexVersion;
+            m_indexBuffer.append(kIndexMagic, sizeof(kIndexMagic));
+            m_indexBuffer.append((const char *)&version, sizeof(version));
+        }
+        // 没有索引的部分时间和级别未知，查询时总是要读
+        m_block.offset = indexed;
+        m_block.count = 0;
+        m_block.minTime = 0;
+        m_block.maxTime = UINT64_MAX;
+        m_block.levels = LogIndexEntry::kAllLevels;
+        m_block.reserved = 0;
+        closeBlockLocked(m_fileSize);
+        writeIndexLocked();
+        if (!m_buffer.empty())
+        {
+            // 缓存里还有没写出的内容，这一块的统计不完整
+            m_block.minTime = 0;
+            m_block.maxTime = UINT64_MAX;
+            m_block.levels = LogIndexEntry::kAllLevels;
+        }
+    }
+
+    void FileLogAppender::closeBlockLocked(uint64_t end)
+    {
+        if (m_indexFd >= 0 && end > m_block.offset)
+        {
+            m_block.length = end - m_block.offset;
+            m_indexBuffer.append((const char *)&m_block, sizeof(m_block));
+        }
+        m_block.offset = end;
+        m_block.length = 0;
+        m_block.count = 0;
+        m_block.minTime = UINT64_MAX;
+        m_block.maxTime = 0;
+        m_block.levels = 0;
+        m_block.reserved = 0;
+    }
+
+    void FileLogAppender::trimIndexLocked()
+    {
+        if (m_indexFd < 0)
+        {
+            return;
+        }
+        // 缓存的索引可能以文件头开始，后面都是还没写出的块
+        size_t pos = 0;
+        if (m_indexBuffer.size() >= sizeof(kIndexMagic) &&
+            memcmp(m_indexBuffer.data(), kIndexMagic, sizeof(kIndexMagic)) == 0)
+        {
+            pos = sizeof(kIndexMagic) + sizeof(kIndexVersion);
+        }
+        uint64_t start = m_block.offset;
+        for (; pos + sizeof(LogIndexEntry) <= m_indexBuffer.size(); pos += sizeof(LogIndexEntry))
+        {
+            LogIndexEntry entry;
+            memcpy(&entry, m_indexBuffer.data() + pos, sizeof(entry));
+            if (entry.offset + entry.length > m_fileSize)
+            {
+                start = entry.offset;
+                m_indexBuffer.resize(pos);
+                break;
+            }
+        }
+        // 从第一个没写完整的块开始重新记录，里面剩下的内容时间和级别未知
+        m_block.offset = start;
+        m_block.count = 0;
+        m_block.minTime = 0;
+        m_block.maxTime = UINT64_MAX;
+        m_block.levels = LogIndexEntry::kAllLevels;
+    }
+
+    void FileLogAppender::writeIndexLocked()
+    {
+        if (m_indexFd >= 0 && !m_indexBuffer.empty())
+        {
+            WriteAll(m_indexFd, m_indexBuffer.data(), m_indexBuffer.size());
+            m_indexBuffer.clear();
+        }
+    }
+
+    // 文件类输出地的错误。可能在后台线程里，stdout可能也是日志输出地，只写stderr
+    static void PrintError(const char *what, const string &name, int err)
+    {
+        std::cerr << what << name << " - " << strerror(err) << std::endl;
+    }
+
+    void FileLogAppender::errorLocked(const char *what, const string &name)
+    {
+        int err = errno;
+        m_errors.fetch_add(1, memory_order_relaxed);
+        if (!m_failing)
+        {
+            m_failing = true;
+            PrintError(what, name, err);
+        }
+    }
+
+    void FileLogAppender::setRotatePeriod(RotatePeriod period)
+    {
+        lock_guard<mutex> lock(m_mutex);
+        m_period = period;
+        updatePeriodEnd();
+    }
+
+    void FileLogAppender::updatePeriodEnd()
+    {
+        time_t now = time(0);
+        struct tm tm;
+        localtime_r(&now, &tm);
+        tm.tm_sec = 0;
+        tm.tm_min = 0;
+        if (m_period == HOURLY)
+        {
+            tm.tm_hour += 1;
+        }
+        else
+        {
+            tm.tm_hour = 0;
+            tm.tm_mday += 1;
+        }
+        tm.tm_isdst = -1;
+        m_periodEnd = mktime(&tm);
+    }
+
+    // 压缩成name.gz后删除原文件
+    static bool GzipFile(const string &name)
+    {
+        int fd = ::open(name.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+        {
+            return false;
+        }
+        string gz_name = name + ".gz";
+        gzFile gz = gzopen(gz_name.c_str(), "wb");
+        if (!gz)
+        {
+            ::close(fd);
+            return false;
+        }
+        char buf[64 * 1024];
+        ssize_t n;
+        bool ok = true;
+        while ((n = ::read(fd, buf, sizeof(buf))) > 0)
+        {
+            if (gzwrite(gz, buf, n) != n)
+            {
+                ok = false;
+                break;
+            }
+        }
+        ok = gzclose(gz) == Z_OK && ok && n == 0;
+        ::close(fd);
+        if (ok)
+        {
+            ::unlink(name.c_str());
+        }
+        else
+        {
+            ::unlink(gz_name.c_str());
+        }
+        return ok;
+    }
+
+    // 删除最旧的切分文件，只保留max_files个。切分文件名是 文件名.时间[.N][.gz]
+    static void RemoveOldFiles(const string &filename, uint32_t max_files)
+    {
+        size_t pos = filename.rfind('/');
+        string dir = pos == string::npos ? "." : filename.substr(0, pos + 1);
+        string prefix = (pos == string::npos ? filename : filename.substr(pos + 1)) + ".";
+        DIR *d = opendir(dir.c_str());
+        if (!d)
+        {
+            return;
+        }
+        vector<string> files;
+        while (struct dirent *ent = readdir(d))
+        {
+            string name = ent->d_name;
+            if (name.size() > prefix.size() && name.compare(0, prefix.size(), prefix) == 0 && isdigit(name[prefix.size()]) &&
+                (name.size() < 4 || name.compare(name.size() - 4, 4, ".idx") != 0))
+            {
+                files.push_back(name);
+            }
+        }
+        closedir(d);
+        if (files.size() <= max_files)
+        {
+            return;
+        }
+        // 同一秒内切分多次的文件名带.N后缀，按(时间, N)排序
+        auto key = [&prefix](const string &name)
+        {
+            size_t ts_end = name.find('.', prefix.size());
+            string ts = name.substr(prefix.size(), ts_end - prefix.size());
+            int n = ts_end == string::npos ? 0 : atoi(name.c_str() + ts_end + 1);
+            return make_pair(ts, n);
+        };
+        sort(files.begin(), files.end(), [&key](const string &a, const string &b)
+             { return key(a) < key(b); });
+        for (size_t i = 0; i < files.size() - max_files; ++i)
+        {
+            string path = pos == string::npos ? files[i] : dir + files[i];
+            ::unlink(path.c_str());
+            ::unlink((path + ".idx").c_str());
+        }
+    }
+
+    // 切分后的文件名：文件名.开始写的时间[.N]
+    static string RotatedName(const string &filename, time_t open_time)
+    {
+        struct tm tm;
+        localtime_r(&open_time, &tm);
+        char buf[32];
+        strftime(buf, sizeof(buf), ".%Y%m%d-%H%M%S", &tm);
+        string rotated = filename + buf;
+        struct stat st;
+        for (int i = 1; stat(rotated.c_str(), &st) == 0 || stat((rotated + ".gz").c_str(), &st) == 0; ++i)
+        {
+            rotated = filename + buf + "." + to_string(i);
+        }
+        return rotated;
+    }
+
+    // 切分后的压缩和清理由一个常驻线程按顺序执行，不会有多个线程同时压缩、删除同一目录下的文件。
+    // 和LogFlusher一样进程退出时不析构
+    class LogCleaner
+    {
+    public:
+        static LogCleaner *GetInstance()
+        {
+            static LogCleaner *s_cleaner = new LogCleaner;
+            return s_cleaner;
+        }
+
+        void post(function<void()> cb)
+        {
+            {
+                lock_guard<mutex> lock(m_mutex);
+                m_tasks.push_back(cb);
+            }
+            m_cond.notify_one();
+        }
+
+    private:
+        LogCleaner()
+        {
+            // 析构时detach
+            Thread(bind(&LogCleaner::run, this), "log_rotate");
+        }
+        void run()
+        {
+            while (true)
+            {
+                function<void()> cb;
+                {
+                    unique_lock<mutex> lock(m_mutex);
+                    m_cond.wait(lock, [this]()
+                                { return !m_tasks.empty(); });
+                    cb.swap(m_tasks.front());
+                    m_tasks.pop_front();
+                }
+                cb();
+            }
+        }
+
+    private:
+        mutex m_mutex;
+        condition_variable m_cond;
+        list<function<void()>> m_tasks;
+    };
+
+    // 压缩切分出来的文件、删除多余的旧文件，交给LogCleaner做
+    static void CleanRotated(const string &filename, const string &rotated, bool compress, uint32_t max_files)
+    {
+        if (!compress && !max_files)
+        {
+            return;
+        }
+        LogCleaner::GetInstance()->post([filename, rotated, compress, max_files]()
+                                        {
+                                            if (compress)
+                                            {
+                                                // 索引的偏移量对应压缩前的文件，压缩后没用了
+                                                GzipFile(rotated);
+                                                ::unlink((rotated + ".idx").c_str());
+                                            }
+                                            if (max_files)
+                                            {
+                                                RemoveOldFiles(filename, max_files);
+                                            } });
+    }
+
+    void FileLogAppender::rotate()
+    {
+        time_t open_time;
+        bool index;
+        {
+            lock_guard<mutex> lock(m_mutex);
+            open_time = m_openTime;
+            index = m_index;
+        }
+        string rotated = RotatedName(m_filename, open_time);
+
+        // rename之后旧fd还指向改名后的文件，日志线程可以继续写，这期间的内容都属于旧文件
+        bool renamed = ::rename(m_filename.c_str(), rotated.c_str()) == 0;
+        int fd = renamed ? ::open(m_filename.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644) : -1;
+        if (renamed && fd < 0)
+        {
+            // 新文件打不开就改回原名，旧fd接着写，不能让清理线程压缩还在写的文件
+            int err = errno;
+            renamed = ::rename(rotated.c_str(), m_filename.c_str()) != 0;
+            errno = err;
+        }
+        int index_fd = -1;
+        if (fd >= 0 && index)
+        {
+            // 索引跟着日志文件改名，旧的索引fd同样继续有效
+            string name = m_filename + ".idx";
+            ::rename(name.c_str(), (rotated + ".idx").c_str());
+            index_fd = ::open(name.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+        }
+        int old_fd = -1;
+        int old_index_fd = -1;
+        {
+            // 锁里只写出缓存和换fd
+            lock_guard<mutex> lock(m_mutex);
+            if (fd >= 0)
+            {
+                flushLocked();
+                if (m_indexFd >= 0)
+                {
+                    closeBlockLocked(m_fileSize);
+                    writeIndexLocked();
+                }
+                old_fd = m_fd;
+                old_index_fd = m_indexFd;
+                m_fd = fd;
+                m_indexFd = index_fd;
+                m_fileSize = 0;
+                m_openTime = time(0);
+                m_indexBuffer.clear();
+                closeBlockLocked(0);
+                if (m_indexFd >= 0)
+                {
+                    uint32_t version = kIndexVersion;
+                    m_indexBuffer.append(kIndexMagic, sizeof(kIndexMagic));
+                    m_indexBuffer.append((const char *)&version, sizeof(version));
+                }
+                if (m_index != (m_indexFd >= 0))
+                {
+                    // 期间改过setIndex或者新索引没打开，按当前设置重新打开
+                    openIndexLocked();
+                }
+                onFileOpened();
+            }
+            else
+            {
+                // 切分失败也要重置，避免每次刷新都重新投递
+                errorLocked("rotate log file error: ", m_filename);
+                m_fileSize = 0;
+            }
+            if (m_period != NONE)
+            {
+                updatePeriodEnd();
+            }
+            m_rotating = false;
+        }
+        if (old_fd >= 0)
+        {
+            ::close(old_fd);
+        }
+        if (old_index_fd >= 0)
+        {
+            ::close(old_index_fd);
+        }
+        if (renamed)
+        {
+            CleanRotated(m_filename, rotated, m_compress, m_maxFiles);
+        }
+    }
+
+    bool FileLogAppender::reopen()
+    {
+        lock_guard<mutex> lock(m_mutex);
+        flushLocked();
+        return openLocked();
+    }
+
+    void FileLogAppender::RequestReopen()
+    {
+        s_reopenGen.fetch_add(1);
+    }
+
+    static void ReopenSignalHandler(int)
+    {
+        FileLogAppender::RequestReopen();
+    }
+
+    void FileLogAppender::InstallReopenSignal(int sig)
+    {
+        struct sigaction sa;
+        memset(&sa, 0, sizeof(sa));
+        sa.sa_handler = ReopenSignalHandler;
+        sa.sa_flags = SA_RESTART;
+        sigemptyset(&sa.sa_mask);
+        sigaction(sig, &sa, nullptr);
+    }
+
+    MmapFileLogAppender::MmapFileLogAppender(const string &filename, uint64_t max_size, uint64_t chunk_size)
+        : m_filename(filename), m_maxSize(max_size), m_chunkSize(max(chunk_size, (uint64_t)4096)),
+          m_reopenGen(s_reopenGen.load())
+    {
+        lock_guard<mutex> lock(m_mutex);
+        openLocked(false);
+    }
+
+    MmapFileLogAppender::~MmapFileLogAppender()
+    {
+        lock_guard<mutex> lock(m_mutex);
+        sealLocked();
+        closeLocked();
+    }
+
+    void MmapFileLogAppender::log(shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event)
+    {
+        if (level < m_level)
+        {
+            return;
+        }
+        uint32_t reopen_gen = s_reopenGen.load(memory_order_relaxed);
+        if (m_reopenGen.load(memory_order_relaxed) != reopen_gen)
+        {
+            lock_guard<mutex> lock(m_mutex);
+            if (m_reopenGen.exchange(reopen_gen) != reopen_gen)
+            {
+                sealLocked();
+                closeLocked();
+                openLocked(false);
+            }
+        }
+        const string &str = formatEvent(logger.get(), level, *event);
+        // 加上换行，超过单个文件大小时截断
+        uint64_t len = min<uint64_t>(str.size() + 1, m_maxSize);
+        while (true)
+        {
+            // 和sealLocked配合：先登记再检查，切分的线程要么看到这里的登记，要么这里看到封闭
+            m_writers.fetch_add(1);
+            if (m_sealed.load())
+            {
+                m_writers.fetch_sub(1);
+                lock_guard<mutex> lock(m_mutex);
+                // 拿到锁时切分已经结束，打不开文件就丢掉
+                if (!m_base && !openLocked(false))
+                {
+                    m_dropped.fetch_add(len, memory_order_relaxed);
+                    return;
+                }
+                continue;
+            }
+            uint32_t gen = m_gen.load(memory_order_relaxed);
+            uint64_t off = m_offset.fetch_add(len, memory_order_relaxed);
+            if (off + len <= m_maxSize)
+            {
+                // 预分配失败(比如磁盘满了)时丢掉，这段位置在文件里留成0
+                if (off + len <= m_committed.load(memory_order_acquire) || grow(off + len))
+                {
+                    memcpy(m_base + off, str.data(), min<uint64_t>(str.size(), len));
+                    if (len > str.size())
+                    {
+                        m_base[off + str.size()] = '\n';
+                    }
+                }
+                else
+                {
+                    m_dropped.fetch_add(len, memory_order_relaxed);
+                }
+                m_writers.fetch_sub(1, memory_order_release);
+                return;
+            }
+            if (off < m_maxSize)
+            {
+                // 只有一个线程会跨过末尾
+                m_tail.store(off);
+            }
+            m_writers.fetch_sub(1, memory_order_release);
+            rotate(gen);
+        }
+    }
+
+    void MmapFileLogAppender::flush()
+    {
+        lock_guard<mutex> lock(m_mutex);
+        if (m_base)
+        {
+            msync(m_base, m_committed.load(), MS_ASYNC);
+        }
+    }
+
+    bool MmapFileLogAppender::reopen()
+    {
+        lock_guard<mutex> lock(m_mutex);
+        m_reopenGen = s_reopenGen.load();
+        sealLocked();
+        closeLocked();
+        return openLocked(false);
+    }
+
+    void MmapFileLogAppender::sealLocked()
+    {
+        m_sealed.store(true);
+        while (m_writers.load() != 0)
+        {
+            this_thread::yield();
+        }
+    }
+
+    void MmapFileLogAppender::rotate(uint32_t gen)
+    {
+        lock_guard<mutex> lock(m_mutex);
+        if (gen != m_gen.load() || !m_base)
+        {
+            // 别的线程已经切分过了
+            return;
+        }
+        sealLocked();
+        closeLocked();
+        openLocked(true);
+    }
+
+    void MmapFileLogAppender::errorLocked(const char *what)
+    {
+        int err = errno;
+        m_errors.fetch_add(1, memory_order_relaxed);
+        if (!m_failing.exchange(true))
+        {
+            PrintError(what, m_filename, err);
+        }
+    }
+
+    bool MmapFileLogAppender::grow(uint64_t end)
+    {
+        lock_guard<mutex> lock(m_growMutex);
+        uint64_t committed = m_committed.load(memory_order_relaxed);
+        if (end <= committed)
+        {
+            return true;
+        }
+        uint64_t new_end = min(m_maxSize, max(end, committed + m_chunkSize));
+        int rt = posix_fallocate(m_fd, committed, new_end - committed);
+        if (rt == EOPNOTSUPP || rt == EINVAL)
+        {
+            // 文件系统不支持预分配，退回到扩展文件长度
+            rt = ftruncate(m_fd, new_end) == 0 ? 0 : errno;
+        }
+        if (rt != 0)
+        {
+            errno = rt;
+            errorLocked("grow log file error: ");
+            return false;
+        }
+        m_failing.store(false, memory_order_relaxed);
+        m_committed.store(new_end, memory_order_release);
+        return true;
+    }
+
+    bool MmapFileLogAppender::openLocked(bool rotate)
+    {
+        int fd = ::open(m_filename.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+        struct stat st;
+        if (fd >= 0 && fstat(fd, &st) == 0 && (rotate || (uint64_t)st.st_size >= m_maxSize))
+        {
+            // 当前文件写满了，重命名后打开新文件
+            time_t open_time = rotate ? m_openTime : st.st_mtime;
+            ::close(fd);
+            fd = -1;
+            string rotated = RotatedName(m_filename, open_time);
+            if (::rename(m_filename.c_str(), rotated.c_str()) == 0)
+            {
+                CleanRotated(m_filename, rotated, m_compress, m_maxFiles);
+                fd = ::open(m_filename.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+            }
+            if (fd >= 0 && fstat(fd, &st) != 0)
+            {
+                ::close(fd);
+                fd = -1;
+            }
+        }
+        void *base = fd >= 0 ? mmap(nullptr, m_maxSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+        if (base == MAP_FAILED)
+        {
+            errorLocked("open log file error: ");
+            if (fd >= 0)
+            {
+                ::close(fd);
+            }
+            return false;
+        }
+        m_failing.store(false, memory_order_relaxed);
+        uint64_t size = st.st_size;
+        m_fd = fd;
+        m_base = (char *)base;
+        m_offset.store(size);
+        m_committed.store(size);
+        m_tail.store(max(m_maxSize, size));
+        m_openTime = size > 0 ? st.st_mtime : time(0);
+        m_gen.fetch_add(1);
+        m_sealed.store(false);
+        return true;
+    }
+
+    void MmapFileLogAppender::closeLocked()
+    {
+        if (!m_base)
+        {
+            return;
+        }
+        munmap(m_base, m_maxSize);
+        // 去掉预分配但没有用到的部分
+        uint64_t len = min(min(m_offset.load(), m_tail.load()), m_committed.load());
+        if (ftruncate(m_fd, len) != 0)
+        {
+            errorLocked("truncate log file error: ");
+        }
+        ::close(m_fd);
+        m_fd = -1;
+        m_base = nullptr;
+    }
+
+    // io_uring的三块共享内存，直接用系统调用，不依赖liburing
+    struct UringFileLogAppender::Uring
+    {
+        int fd = -1;
+        void *sqRing = MAP_FAILED;
+        size_t sqRingSize = 0;
+        void *cqRing = MAP_FAILED;
+        size_t cqRingSize = 0;
+        io_uring_sqe *sqes = (io_uring_sqe *)MAP_FAILED;
+        size_t sqesSize = 0;
+        unsigned *sqTail;
+        unsigned *sqMask;
+        unsigned *sqArray;
+        unsigned *cqHead;
+        unsigned *cqTail;
+        unsigned *cqMask;
+        io_uring_cqe *cqes;
+        bool fixed = false; // 缓存注册成功，用WRITE_FIXED
+
+        ~Uring()
+        {
+            if (sqes != MAP_FAILED)
+            {
+                munmap(sqes, sqesSize);
+            }
+            if (cqRing != MAP_FAILED && cqRing != sqRing)
+            {
+                munmap(cqRing, cqRingSize);
+            }
+            if (sqRing != MAP_FAILED)
+            {
+                munmap(sqRing, sqRingSize);
+            }
+            if (fd >= 0)
+            {
+                ::close(fd);
+            }
+        }
+
+        // 失败返回nullptr
+        static Uring *Create(unsigned entries)
+        {
+            io_uring_params p;
+            memset(&p, 0, sizeof(p));
+            unique_ptr<Uring> ring(new Uring);
+            ring->fd = syscall(__NR_io_uring_setup, entries, &p);
+            if (ring->fd < 0)
+            {
+                return nullptr;
+            }
+            ring->sqRingSize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+            ring->cqRingSize = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+            if (p.features & IORING_FEAT_SINGLE_MMAP)
+            {
+                ring->sqRingSize = ring->cqRingSize = max(ring->sqRingSize, ring->cqRingSize);
+            }
+            ring->sqRing = mmap(nullptr, ring->sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                                ring->fd, IORING_OFF_SQ_RING);
+            if (ring->sqRing == MAP_FAILED)
+            {
+                return nullptr;
+            }
+            ring->cqRing = (p.features & IORING_FEAT_SINGLE_MMAP)
+                               ? ring->sqRing
+                               : mmap(nullptr, ring->cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                                      ring->fd, IORING_OFF_CQ_RING);
+            if (ring->cqRing == MAP_FAILED)
+            {
+                return nullptr;
+            }
+            ring->sqesSize = p.sq_entries * sizeof(io_uring_sqe);
+            ring->sqes = (io_uring_sqe *)mmap(nullptr, ring->sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                                              ring->fd, IORING_OFF_SQES);
+            if (ring->sqes == MAP_FAILED)
+            {
+                return nullptr;
+            }
+            char *sq = (char *)ring->sqRing;
+            char *cq = (char *)ring->cqRing;
+            ring->sqTail = (unsigned *)(sq + p.sq_off.tail);
+            ring->sqMask = (unsigned *)(sq + p.sq_off.ring_mask);
+            ring->sqArray = (unsigned *)(sq + p.sq_off.array);
+            ring->cqHead = (unsigned *)(cq + p.cq_off.head);
+            ring->cqTail = (unsigned *)(cq + p.cq_off.tail);
+            ring->cqMask = (unsigned *)(cq + p.cq_off.ring_mask);
+            ring->cqes = (io_uring_cqe *)(cq + p.cq_off.cqes);
+            return ring.release();
+        }
+
+        // 取一个提交项，只在持有appender锁时调用，同时在内核里的请求不超过两个，不会满
+        io_uring_sqe *getSqe()
+        {
+            unsigned tail = *sqTail;
+            unsigned idx = tail & *sqMask;
+            io_uring_sqe *sqe = &sqes[idx];
+            memset(sqe, 0, sizeof(*sqe));
+            sqArray[idx] = idx;
+            __atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+            return sqe;
+        }
+
+        int enter(unsigned to_submit, unsigned min_complete)
+        {
+            while (true)
+            {
+                int rt = syscall(__NR_io_uring_enter, fd, to_submit, min_complete,
+                                 min_complete ? IORING_ENTER_GETEVENTS : 0, nullptr, 0);
+                if (rt < 0 && errno == EINTR)
+                {
+                    continue;
+                }
+                return rt;
+            }
+        }
+    };
+
+    // 完成项的user_data
+    static const uint64_t kUringWrite = 1;
+    static const uint64_t kUringFsync = 2;
+
+    UringFileLogAppender::UringFileLogAppender(const string &filename, size_t buffer_size, uint32_t buffers,
+                                               uint32_t flush_interval)
+        : m_filename(filename), m_bufferSize(max(buffer_size, (size_t)4096)), m_bufferCount(max(buffers, 2u)),
+          m_lengths(m_bufferCount), m_flushInterval(flush_interval), m_reopenGen(s_reopenGen.load())
+    {
+        if (posix_memalign((void **)&m_buffers, 4096, m_bufferSize * m_bufferCount) != 0)
+        {
+            throw bad_alloc();
+        }
+        m_uring.reset(Uring::Create(8));
+        if (m_uring)
+        {
+            vector<iovec> iovs(m_bufferCount);
+            for (uint32_t i = 0; i < m_bufferCount; ++i)
+            {
+                iovs[i].iov_base = m_buffers + i * m_bufferSize;
+                iovs[i].iov_len = m_bufferSize;
+            }
+            // 注册受RLIMIT_MEMLOCK限制，失败时用普通的IORING_OP_WRITE
+            m_uring->fixed = syscall(__NR_io_uring_register, m_uring->fd, IORING_REGISTER_BUFFERS,
+                                     iovs.data(), m_bufferCount) == 0;
+        }
+        m_lastFlush = getCurrentMS();
+        lock_guard<mutex> lock(m_mutex);
+        openLocked();
+        LogFlusher::GetInstance()->add(this, m_flushInterval);
+    }
+
+    UringFileLogAppender::~UringFileLogAppender()
+    {
+        LogFlusher::GetInstance()->del(this);
+        {
+            lock_guard<mutex> lock(m_mutex);
+            syncLocked();
+            m_uring.reset();
+            if (m_fd >= 0)
+            {
+                ::close(m_fd);
+            }
+        }
+        free(m_buffers);
+    }
+
+    bool UringFileLogAppender::openLocked()
+    {
+        if (m_fd >= 0)
+        {
+            ::close(m_fd);
+        }
+        m_fd = ::open(m_filename.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        if (m_fd < 0)
+        {
+            errorLocked("open log file error: ", errno);
+            return false;
+        }
+        return true;
+    }
+
+    void UringFileLogAppender::errorLocked(const char *what, int err)
+    {
+        m_errors.fetch_add(1, memory_order_relaxed);
+        if (!m_failing)
+        {
+            m_failing = true;
+            PrintError(what, m_filename, err);
+        }
+    }
+
+    void UringFileLogAppender::log(shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event)
+    {
+        if (level < m_level)
+        {
+            return;
+        }
+        const string &str = formatEvent(logger.get(), level, *event);
+        lock_guard<mutex> lock(m_mutex);
+        if (m_reopenGen != s_reopenGen.load(memory_order_relaxed))
+        {
+            m_reopenGen = s_reopenGen.load();
+            syncLocked();
+            openLocked();
+        }
+        reapLocked(false);
+        appendLocked(str.data(), str.size());
+        appendLocked("\n", 1);
+        // 错误日志立即提交
+        if (level >= LogLevel::ERROR || getCurrentMS() - m_lastFlush >= m_flushInterval)
+        {
+            sealLocked();
+        }
+    }
+
+    void UringFileLogAppender::appendLocked(const char *data, size_t len)
+    {
+        while (len > 0)
+        {
+            // 所有缓存都在等待写出
+            while (m_fillSeq - m_writeSeq >= m_bufferCount)
+            {
+                reapLocked(true);
+            }
+            uint32_t idx = m_fillSeq % m_bufferCount;
+            size_t n = min(len, m_bufferSize - m_lengths[idx]);
+            memcpy(m_buffers + idx * m_bufferSize + m_lengths[idx], data, n);
+            m_lengths[idx] += n;
+            data += n;
+            len -= n;
+            if (m_lengths[idx] == m_bufferSize)
+            {
+                sealLocked();
+            }
+        }
+    }
+
+    void UringFileLogAppender::flush()
+    {
+        lock_guard<mutex> lock(m_mutex);
+        reapLocked(false);
+        sealLocked();
+    }
+
+    void UringFileLogAppender::sync()
+    {
+        lock_guard<mutex> lock(m_mutex);
+        syncLocked();
+    }
+
+    bool UringFileLogAppender::reopen()
+    {
+        lock_guard<mutex> lock(m_mutex);
+        m_reopenGen = s_reopenGen.load();
+        syncLocked();
+        return openLocked();
+    }
+
+    void UringFileLogAppender::sealLocked()
+    {
+        m_lastFlush = getCurrentMS();
+        if (m_lengths[m_fillSeq % m_bufferCount] > 0)
+        {
+            ++m_fillSeq;
+        }
+        submitLocked();
+    }
+
+    void UringFileLogAppender::submitLocked()
+    {
+        while (m_inflight == 0 && m_writeSeq < m_fillSeq)
+        {
+            uint32_t idx = m_writeSeq % m_bufferCount;
+            char *buf = m_buffers + idx * m_bufferSize + m_written;
+            size_t len = m_lengths[idx] - m_written;
+            if (m_fd < 0 && !openLocked())
+            {
+                // 打不开就丢掉，避免一直阻塞
+                m_dropped.fetch_add(len, memory_order_relaxed);
+                m_lengths[idx] = 0;
+                m_written = 0;
+                ++m_writeSeq;
+                continue;
+            }
+            if (!m_uring)
+            {
+                size_t written = 0;
+                if (!WriteAll(m_fd, buf, len, &written))
+                {
+                    errorLocked("write log file error: ", errno);
+                    m_dropped.fetch_add(len - written, memory_order_relaxed);
+                }
+                else
+                {
+                    m_failing = false;
+                    if (m_fsync)
+                    {
+                        fdatasync(m_fd);
+                    }
+                }
+                m_lengths[idx] = 0;
+                m_written = 0;
+                ++m_writeSeq;
+                continue;
+            }
+            // O_APPEND打开，偏移量被忽略
+            io_uring_sqe *sqe = m_uring->getSqe();
+            sqe->opcode = m_uring->fixed ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+            sqe->fd = m_fd;
+            sqe->addr = (uint64_t)buf;
+            sqe->len = len;
+            sqe->buf_index = m_uring->fixed ? idx : 0;
+            sqe->user_data = kUringWrite;
+            unsigned n = 1;
+            if (m_fsync)
+            {
+                sqe->flags |= IOSQE_IO_LINK;
+                io_uring_sqe *fsync_sqe = m_uring->getSqe();
+                fsync_sqe->opcode = IORING_OP_FSYNC;
+                fsync_sqe->fd = m_fd;
+                fsync_sqe->fsync_flags = IORING_FSYNC_DATASYNC;
+                fsync_sqe->user_data = kUringFsync;
+                n = 2;
+            }
+            if (m_uring->enter(n, 0) < 0)
+            {
+                // 提交失败，之后都用同步write
+                errorLocked("io_uring submit error: ", errno);
+                m_uring.reset();
+                continue;
+            }
+            m_inflight = n;
+        }
+    }
+
+    void UringFileLogAppender::reapLocked(bool wait)
+    {
+        if (!m_uring)
+        {
+            return;
+        }
+        if (wait && m_inflight > 0 && m_uring->enter(0, 1) < 0)
+        {
+            errorLocked("io_uring wait error: ", errno);
+            return;
+        }
+        unsigned head = *m_uring->cqHead;
+        unsigned tail = __atomic_load_n(m_uring->cqTail, __ATOMIC_ACQUIRE);
+        for (; head != tail; ++head)
+        {
+            io_uring_cqe &cqe = m_uring->cqes[head & *m_uring->cqMask];
+            --m_inflight;
+            if (cqe.user_data != kUringWrite)
+            {
+                // 短写时链接的fsync会被取消
+                if (cqe.res < 0 && cqe.res != -ECANCELED)
+                {
+                    errorLocked("io_uring fsync error: ", -cqe.res);
+                }
+                continue;
+            }
+            uint32_t idx = m_writeSeq % m_bufferCount;
+            if (cqe.res > 0 && m_written + cqe.res < m_lengths[idx])
+            {
+                // 短写，剩下的下次提交
+                m_written += cqe.res;
+                continue;
+            }
+            if (cqe.res < 0)
+            {
+                errorLocked("io_uring write error: ", -cqe.res);
+                m_dropped.fetch_add(m_lengths[idx] - m_written, memory_order_relaxed);
+            }
+            else
+            {
+                m_failing = false;
+            }
+            m_lengths[idx] = 0;
+            m_written = 0;
+            ++m_writeSeq;
+        }
+        __atomic_store_n(m_uring->cqHead, head, __ATOMIC_RELEASE);
+        submitLocked();
+    }
+
+    void UringFileLogAppender::syncLocked()
+    {
+        sealLocked();
+        // 链接的fsync也要完成，之后可以安全地关闭fd
+        while (m_uring && (m_writeSeq < m_fillSeq || m_inflight > 0))
+        {
+            reapLocked(true);
+        }
+    }
+
+    StdoutLogAppender::StdoutLogAppender(uint32_t max_latency, size_t buffer_size)
+        : m_bufferSize(buffer_size), m_maxLatency(max_latency), m_tty(isatty(STDOUT_FILENO))
+    {
+        m_lastFlush = getCurrentMS();
+        if (!m_tty && m_maxLatency > 0)
+        {
+            m_buffer.reserve(m_bufferSize + 4096);
+            LogFlusher::GetInstance()->add(this, m_maxLatency);
+        }
+    }
+
+    StdoutLogAppender::~StdoutLogAppender()
+    {
+        LogFlusher::GetInstance()->del(this);
+        lock_guard<mutex> lock(m_mutex);
+        flushLocked();
+    }
+
+    void StdoutLogAppender::log(shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event)
+    {
+        if (level < m_level)
+        {
+            return;
+        }
+        const string &str = formatEvent(logger.get(), level, *event);
+        lock_guard<mutex> lock(m_mutex);
+        if (m_errorToStderr && level >= LogLevel::ERROR)
+        {
+            // 先写出之前的内容，保持和stdout的先后顺序
+            flushLocked();
+            // str可能是线程共享的格式化缓存，后面的appender还要用，复制一份再加换行
+            string line;
+            line.reserve(str.size() + 1);
+            line.append(str).append(1, '\n');
+            WriteAll(STDERR_FILENO, line.data(), line.size());
+            return;
+        }
+        m_buffer.append(str);
+        m_buffer.append(1, '\n');
+        if (m_tty || m_maxLatency == 0 || m_buffer.size() >= m_bufferSize || level >= LogLevel::ERROR ||
+            getCurrentMS() - m_lastFlush >= m_maxLatency)
+        {
+            flushLocked();
+        }
+    }
+
+    void StdoutLogAppender::flush()
+    {
+        lock_guard<mutex> lock(m_mutex);
+        flushLocked();
+    }
+
+    void StdoutLogAppender::flushLocked()
+    {
+        m_lastFlush = getCurrentMS();
+        if (!m_buffer.empty())
+        {
+            WriteAll(STDOUT_FILENO, m_buffer.data(), m_buffer.size());
+            m_buffer.clear();
+        }
+    }
+
+    AsyncLogAppender::AsyncLogAppender(size_t capacity, OverflowPolicy policy)
+        : m_policy(policy)
+    {
+        size_t n = 2;
+        while (n < capacity)
+        {
+            n <<= 1;
+        }
+        m_slots.reset(new Slot[n]);
+        m_mask = n - 1;
+        for (size_t i = 0; i < n; ++i)
+        {
+            m_slots[i].seq.store(i, memory_order_relaxed);
+        }
+        m_thread.reset(new Thread(bind(&AsyncLogAppender::run, this), "log_async"));
+    }
+
+    AsyncLogAppender::~AsyncLogAppender()
+    {
+        stop();
+    }
+
+    void AsyncLogAppender::addAppender(LogAppender::ptr appender)
+    {
+        lock_guard<mutex> lock(m_appendersMutex);
+        if (!appender->hasFormatter())
+        {
+            appender->setFormatter(getFormatter());
+        }
+        m_appenders.push_back(appender);
+    }
+
+    void AsyncLogAppender::delAppender(LogAppender::ptr appender)
+    {
+        lock_guard<mutex> lock(m_appendersMutex);
+        for (auto it = m_appenders.begin(); it != m_appenders.end(); ++it)
+        {
+            if (*it == appender)
+            {
+                m_appenders.erase(it);
+                break;
+            }
+        }
+    }
+
+    // 有界MPMC队列(Vyukov)：slot的seq等于pos表示可写，等于pos+1表示可读
+    bool AsyncLogAppender::tryPush(Logger::ptr &logger, LogLevel::Level level, LogEvent::ptr &event)
+    {
+        uint64_t pos = m_tail.load(memory_order_relaxed);
+        Slot *slot;
+        while (true)
+        {
+            slot = &m_slots[pos & m_mask];
+            uint64_t seq = slot->seq.load(memory_order_acquire);
+            int64_t diff = (int64_t)seq - (int64_t)pos;
+            if (diff == 0)
+            {
+                if (m_tail.compare_exchange_weak(pos, pos + 1, memory_order_relaxed))
+                {
+                    break;
+                }
+            }
+            else if (diff < 0)
+            {
+                return false;
+            }
+            else
+            {
+                pos = m_tail.load(memory_order_relaxed);
+            }
+        }
+        slot->logger = move(logger);
+        slot->event = move(event);
+        slot->level = level;
+        slot->seq.store(pos + 1, memory_order_release);
+        return true;
+    }
+
+    // 只有后台线程调用
+    bool AsyncLogAppender::tryPop(Logger::ptr &logger, LogLevel::Level &level, LogEvent::ptr &event)
+    {
+        uint64_t pos = m_head.load(memory_order_relaxed);
+        Slot &slot = m_slots[pos & m_mask];
+        if (slot.seq.load(memory_order_acquire) != pos + 1)
+        {
+            return false;
+        }
+        logger = move(slot.logger);
+        event = move(slot.event);
+        level = slot.level;
+        slot.seq.store(pos + m_mask + 1, memory_order_release);
+        return true;
+    }
+
+    size_t AsyncLogAppender::size() const
+    {
+        uint64_t tail = m_tail.load(memory_order_relaxed);
+        uint64_t head = m_head.load(memory_order_relaxed);
+        return tail > head ? tail - head : 0;
+    }
+
+    void AsyncLogAppender::wakeConsumer()
+    {
+        atomic_thread_fence(memory_order_seq_cst);
+        if (m_sleeping.load(memory_order_relaxed))
+        {
+            lock_guard<mutex> lock(m_mutex);
+            m_cond.notify_one();
+        }
+    }
+
+    void AsyncLogAppender::logSync(Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event)
+    {
+        lock_guard<mutex> lock(m_appendersMutex);
+        for (auto &i : m_appenders)
+        {
+            i->log(logger, level, event);
+        }
+    }
+
+    void AsyncLogAppender::log(Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event)
+    {
+        if (level < m_level)
+        {
+            return;
+        }
+        if (m_stop.load(memory_order_acquire))
+        {
+            logSync(logger, level, event);
+            return;
+        }
+        if (m_policy == DROP_DEBUG_FIRST && level <= LogLevel::DEBUG && size() >= getCapacity() / 4 * 3)
+        {
+            m_dropped.fetch_add(1, memory_order_relaxed);
+            return;
+        }
+        while (!tryPush(logger, level, event))
+        {
+            if (m_policy == DROP_NEWEST || (m_policy == DROP_DEBUG_FIRST && level <= LogLevel::DEBUG))
+            {
+                m_dropped.fetch_add(1, memory_order_relaxed);
+                return;
+            }
+            if (m_stop.load(memory_order_acquire))
+            {
+                logSync(logger, level, event);
+                return;
+            }
+            // 队列满了，等消费者腾出位置
+            m_waiting.fetch_add(1);
+            wakeConsumer();
+            {
+                unique_lock<mutex> lock(m_mutex);
+                m_doneCond.wait_for(lock, chrono::milliseconds(1));
+            }
+            m_waiting.fetch_sub(1);
+        }
+        wakeConsumer();
+    }
+
+    void AsyncLogAppender::flush()
+    {
+        uint64_t target = m_tail.load();
+        m_waiting.fetch_add(1);
+        {
+            unique_lock<mutex> lock(m_mutex);
+            while (m_head.load() < target && !m_stop.load())
+            {
+                m_cond.notify_one();
+                m_doneCond.wait_for(lock, chrono::milliseconds(10));
+            }
+        }
+        m_waiting.fetch_sub(1);
+        lock_guard<mutex> lock(m_appendersMutex);
+        for (auto &i : m_appenders)
+        {
+            i->flush();
+        }
+    }
+
+    void AsyncLogAppender::stop()
+    {
+        if (m_stop.exchange(true))
+        {
+            return;
+        }
+        {
+            lock_guard<mutex> lock(m_mutex);
+            m_cond.notify_one();
+        }
+        m_thread->join();
+        // 线程退出后才入队的事件
+        Logger::ptr logger;
+        LogEvent::ptr event;
+        LogLevel::Level level;
+        while (tryPop(logger, level, event))
+        {
+            logSync(logger, level, event);
+            m_head.fetch_add(1, memory_order_release);
+        }
+        flush();
+    }
+
+    void AsyncLogAppender::run()
+    {
+        Logger::ptr logger;
+        LogEvent::ptr event;
+        LogLevel::Level level;
+        while (true)
+        {
+            size_t n = 0;
+            {
+                lock_guard<mutex> lock(m_appendersMutex);
+                while (n < 256 && tryPop(logger, level, event))
+                {
+                    for (auto &i : m_appenders)
+                    {
+                        if (!i->hasFormatter())
+                        {
+                            i->setFormatter(getFormatter());
+                        }
+                        i->log(logger, level, event);
+                    }
+                    logger.reset();
+                    event.reset();
+                    m_head.fetch_add(1, memory_order_release);
+                    ++n;
+                }
+                // 队列空了就把下游攒着的内容刷出去
+                if (n < 256 && size() == 0)
+                {
+                    for (auto &i : m_appenders)
+                    {
+                        i->flush();
+                    }
+                }
+            }
+            if (n > 0 && m_waiting.load() > 0)
+            {
+                lock_guard<mutex> lock(m_mutex);
+                m_doneCond.notify_all();
+            }
+            if (n == 256)
+            {
+                continue;
+            }
+
+            unique_lock<mutex> lock(m_mutex);
+            m_sleeping.store(true);
+            atomic_thread_fence(memory_order_seq_cst);
+            if (size() == 0)
+            {
+                if (m_stop.load())
+                {
+                    m_sleeping.store(false);
+                    break;
+                }
+                m_doneCond.notify_all();
+                m_cond.wait_for(lock, chrono::milliseconds(100));
+            }
+            m_sleeping.store(false);
+        }
+    }
+
+    LogFormatter::LogFormatter(const string &pattern) : m_pattern(pattern) { init(); }
+
+    void LogFormatter::init()
+    {
+        vector<tuple<string, string, int>> vec;
+        string nstr;
+        for (size_t i = 0; i < m_pattern.size(); ++i)
+        {
+            if (m_pattern[i] != '%')
+            {
+                nstr.append(1, m_pattern[i]);
+                continue;
+            }
+            size_t n = i + 1;
+            int fmt_status = 0;
+            size_t fmt_begin = 0;
+            string str;
+            string fmt;
+            while (n < m_pattern.size())
+            {
+                if (!fmt_status && (!isalpha(m_pattern[n]) && m_pattern[n] != '{' && m_pattern[n] != '}'))
+                {
+                    str = m_pattern.substr(i + 1, n - i - 1);
+                    break;
+                }
+
+                if (fmt_status == 0)
+                {
+                    if (m_pattern[n] == '{')
+                    {
+                        str = m_pattern.substr(i + 1, n - i - 1);
+                        fmt_status = 1; // 解析格式
+                        fmt_begin = n;
+                        ++n;
+                        continue;
+                    }
+                }
+                if (fmt_status == 1)
+                {
+                    if (m_pattern[n] == '}')
+                    {
+                        fmt = m_pattern.substr(fmt_begin + 1, n - fmt_begin - 1);
+                        fmt_status = 0;
+                        ++n;
+                        break;
+                    }
+                }
+                ++n;
+                if (n == m_pattern.size())
+                {
+                    if (str.empty())
+                    {
+                        str = m_pattern.substr(i + 1);
+                    }
+                }
+            }
+            if (fmt_status == 0)
+            {
+                if (!nstr.empty())
+                {
+                    vec.push_back(make_tuple(nstr, string(), 0));
+                    nstr.clear();
+                }
+                vec.push_back(make_tuple(str, fmt, 1));
+                i = n - 1;
+            }
+            else if (fmt_status == 1)
+            {
+                std::cout << "pattern parse error: " << m_pattern << " - " << m_pattern.substr(i) << std::endl;
+                m_error = true;
+                vec.push_back(std::make_tuple("<<pattern_error>>", fmt, 0));
+            }
+        }
+
+        if (!nstr.empty())
+        {
+            vec.push_back(make_tuple(nstr, string(), 0));
+        }
+
+        /*
+            %m 消息体
+            %p level
+            %r 启动后的时间
+            %c 日志名称
+            %t 线程id
+            %N 线程名
+            %F 协程id
+            %n 回车换行
+            %T Tab
+            %d 时间
+            %f 文件名
+            %l 行号
+            %ms 毫秒
+            %us 微秒
+            %k 结构化字段
+        */
+        static map<string, OpCode> s_ops = {
+            {"m", OP_MESSAGE},
+            {"p", OP_LEVEL},
+            {"r", OP_ELAPSED},
+            {"c", OP_NAME},
+            {"t", OP_THREAD_ID},
+            {"N", OP_THREAD_NAME},
+            {"d", OP_DATETIME},
+            {"f", OP_FILE},
+            {"l", OP_LINE},
+            {"F", OP_FIBER_ID},
+            {"ms", OP_MSEC},
+            {"us", OP_USEC},
+            {"k", OP_FIELDS}};
+        m_ops.clear();
+        m_strings.clear();
+        m_dates.clear();
+        for (auto &i : vec)
+        {
+            if (get<2>(i) == 0)
+            {
+                addOp(OP_LITERAL, get<0>(i));
+            }
+            else if (get<0>(i) == "n")
+            {
+                addOp(OP_LITERAL, "\n");
+            }
+            else if (get<0>(i) == "T")
+            {
+                addOp(OP_LITERAL, "\t");
+            }
+            else
+            {
+                auto it = s_ops.find(get<0>(i));
+                if (it == s_ops.end())
+                {
+                    addOp(OP_LITERAL, "<<error_format %" + get<0>(i) + ">>");
+                    m_error = true;
+                }
+                else if (it->second == OP_DATETIME)
+                {
+                    addDateOp(get<1>(i).empty() ? "%Y-%m-%d %H:%M:%S" : get<1>(i));
+                }
+                else
+                {
+                    addOp(it->second);
+                }
+            }
+        }
+    }
+
+    void LogFormatter::addOp(OpCode code, const string &arg)
+    {
+        if (code == OP_LITERAL && !m_ops.empty() && m_ops.back().code == OP_LITERAL &&
+            m_ops.back().offset + m_ops.back().len == m_strings.size())
+        {
+            m_ops.back().len += arg.size();
+        }
+        else
+        {
+            m_ops.push_back(Op{code, (uint32_t)m_strings.size(), (uint32_t)arg.size()});
+        }
+        m_strings.append(arg);
+    }
+
+    void LogFormatter::addDateOp(const string &fmt)
+    {
+        static atomic<uint32_t> s_id{0};
+        DateFormat df{++s_id, DATE_MINUTE, 0};
+        size_t sec_pos = string::npos;
+        for (size_t i = 0; i + 1 < fmt.size(); ++i)
+        {
+            if (fmt[i] != '%')
+            {
+                continue;
+            }
+            char c = fmt[++i];
+            if (c == 'S' && sec_pos == string::npos && df.mode == DATE_MINUTE)
+            {
+                sec_pos = i - 1;
+                df.mode = DATE_PATCH;
+            }
+            else if (c != '%' && strchr("aAbBCdDeFgGhHIjmMnpRtuUVwWyYzZ", c) == nullptr)
+            {
+                // 第二个%S或者%T、%s、%c等也依赖秒数的
+                df.mode = DATE_SECOND;
+            }
+        }
+        if (df.mode == DATE_PATCH)
+        {
+            df.prefixOffset = m_strings.size();
+            m_strings.append(fmt, 0, sec_pos);
+            m_strings.append(1, '\0');
+        }
+        m_ops.push_back(Op{OP_DATETIME, (uint32_t)m_strings.size(), (uint32_t)m_dates.size()});
+        m_strings.append(fmt);
+        m_strings.append(1, '\0'); // strftime需要以0结尾
+        m_dates.push_back(df);
+    }
+
+    // %d的线程缓存，localtime_r在glibc里要加全局锁，同一分钟内只调用一次
+    struct DateTimeCache
+    {
+        uint32_t id = 0;
+        int64_t sec = -1;    // 缓存的结果对应的时间
+        int64_t minute = 0;  // 所在分钟开始的时间
+        uint32_t secPos = 0; // 秒数在buf里的位置
+        uint32_t len = 0;
+        char buf[64];
+    };
+    static thread_local DateTimeCache t_dateCache[16];
+
+    void LogFormatter::formatDate(string &out, const Op &op, uint64_t time) const
+    {
+        const DateFormat &df = m_dates[op.len];
+        DateTimeCache &c = t_dateCache[df.id & 15];
+        int64_t sec = time;
+        if (c.id != df.id || sec < c.minute || sec >= c.minute + 60 || (df.mode == DATE_SECOND && sec != c.sec))
+        {
+            struct tm tm;
+            time_t t = sec;
+            localtime_r(&t, &tm);
+            c.id = df.id;
+            c.sec = sec;
+            c.minute = sec - tm.tm_sec;
+            c.len = strftime(c.buf, sizeof(c.buf), m_strings.data() + op.offset, &tm);
+            if (df.mode == DATE_PATCH)
+            {
+                char tmp[64];
+                c.secPos = strftime(tmp, sizeof(tmp), m_strings.data() + df.prefixOffset, &tm);
+            }
+        }
+        else if (df.mode == DATE_PATCH && sec != c.sec && c.secPos + 2 <= c.len)
+        {
+            int s = sec - c.minute;
+            c.buf[c.secPos] = '0' + s / 10;
+            c.buf[c.secPos + 1] = '0' + s % 10;
+            c.sec = sec;
+        }
+        out.append(c.buf, c.len);
+    }
+
+    void LogFormatter::format(string &out, Logger *logger, LogLevel::Level level, const LogEvent &event) const
+    {
+        const char *strings = m_strings.data();
+        for (const Op &op : m_ops)
+        {
+            switch (op.code)
+            {
+            case OP_LITERAL:
+                out.append(strings + op.offset, op.len);
+                break;
+            case OP_MESSAGE:
+                out.append(event.getContent());
+                break;
+            case OP_LEVEL:
+                out.append(LogLevel::toString(level));
+                break;
+            case OP_ELAPSED:
+                AppendUInt(out, event.getElapsed());
+                break;
+            case OP_NAME:
+                out.append(event.getLogger()->getName());
+                break;
+            case OP_THREAD_ID:
+                AppendUInt(out, event.getThreadID());
+                break;
+            case OP_THREAD_NAME:
+                out.append(event.getThreadName());
+                break;
+            case OP_FIBER_ID:
+                AppendUInt(out, event.getFiberID());
+                break;
+            case OP_DATETIME:
+                formatDate(out, op, event.getTime());
+                break;
+            case OP_MSEC:
+                AppendFixed(out, event.getTimeUS() / 1000 % 1000, 3);
+                break;
+            case OP_USEC:
+                AppendFixed(out, event.getTimeUS() % 1000000, 6);
+                break;
+            case OP_FIELDS:
+                AppendFieldsText(out, event.getFields());
+                break;
+            case OP_FILE:
+                out.append(event.getFile());
+                break;
+            case OP_LINE:
+                AppendInt(out, event.getLine());
+                break;
+            }
+        }
+    }
+
+    JsonLogFormatter::JsonLogFormatter(const string &time_pattern)
+        : LogFormatter(time_pattern)
+    {
+    }
+
+    void JsonLogFormatter::format(string &out, Logger *logger, LogLevel::Level level, const LogEvent &event) const
+    {
+        out.append("{\"time\":\"");
+        // 时间用基类按time_pattern格式化，复用线程的时间缓存
+        LogFormatter::format(out, logger, level, event);
+        out.append("\",\"level\":\"");
+        out.append(LogLevel::toString(level));
+        out.append("\",\"logger\":");
+        AppendJsonString(out, event.getLogger()->getName().data(), event.getLogger()->getName().size());
+        out.append(",\"thread\":");
+        AppendUInt(out, event.getThreadID());
+        out.append(",\"thread_name\":");
+        AppendJsonString(out, event.getThreadName(), strlen(event.getThreadName()));
+        out.append(",\"fiber\":");
+        AppendUInt(out, event.getFiberID());
+        out.append(",\"file\":");
+        AppendJsonString(out, event.getFile(), strlen(event.getFile()));
+        out.append(",\"line\":");
+        AppendInt(out, event.getLine());
+        out.append(",\"msg\":");
+        AppendJsonString(out, event.getContent().data(), event.getContent().size());
+        const LogFields &fields = event.getFields();
+        for (size_t i = 0; i < fields.size(); ++i)
+        {
+            const LogFields::Field &f = fields[i];
+            out.append(1, ',');
+            AppendJsonString(out, fields.key(f), f.keyLen);
+            out.append(1, ':');
+            switch (f.type)
+            {
+            case LogFields::INT:
+                AppendInt(out, f.i);
+                break;
+            case LogFields::UINT:
+                AppendUInt(out, f.u);
+                break;
+            case LogFields::DOUBLE:
+                AppendJsonDouble(out, f.d);
+                break;
+            case LogFields::BOOL:
+                out.append(f.b ? "true" : "false");
+                break;
+            case LogFields::STRING:
+                AppendJsonString(out, fields.str(f), f.s.len);
+                break;
+            }
+        }
+        out.append(1, '}');
+    }
+
+    string LogFormatter::format(shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event)
+    {
+        string out;
+        format(out, logger.get(), level, *event);
+        return out;
+    }
+
+    static atomic<uint32_t> s_dumpGen{0};
+    static atomic<uint64_t> s_ringAppenderId{0};
+
+    // 线程最近用过的几个环，appender的id不会复用
+    static const int kRingCacheSize = 4;
+    static thread_local pair<uint64_t, void *> t_ringCache[kRingCacheSize];
+    static thread_local int t_ringCacheNext = 0;
+
+    // 线程退出时依次调用，之后再注册的不会被调用
+    struct ThreadExitCallbacks
+    {
+        ~ThreadExitCallbacks()
+        {
+            exited = true;
+            for (auto &i : cbs)
+            {
+                i();
+            }
+        }
+        vector<function<void()>> cbs;
+        bool exited = false;
+    };
+    static thread_local ThreadExitCallbacks t_exitCallbacks;
+
+    bool detail::AtThreadExit(function<void()> cb)
+    {
+        if (t_exitCallbacks.exited)
+        {
+            return false;
+        }
+        t_exitCallbacks.cbs.push_back(move(cb));
+        return true;
+    }
+
+    RingBufferLogAppender::RingBufferLogAppender(LogAppender::ptr target, size_t capacity, LogLevel::Level trigger)
+        : m_target(target), m_capacity(max(capacity, (size_t)1)), m_trigger(trigger),
+          m_id(++s_ringAppenderId), m_dumpGen(s_dumpGen.load()), m_rings(make_shared<Rings>())
+    {
+        LogFlusher::GetInstance()->add(this, 1000);
+    }
+
+    RingBufferLogAppender::~RingBufferLogAppender()
+    {
+        LogFlusher::GetInstance()->del(this);
+    }
+
+    shared_ptr<RingBufferLogAppender::Ring> RingBufferLogAppender::newRing() const
+    {
+        shared_ptr<Ring> ring = make_shared<Ring>();
+        ring->entries.resize(m_capacity);
+        ring->spare.resize(m_capacity);
+        for (size_t i = 0; i < m_capacity; ++i)
+        {
+            ring->entries[i] = make_shared<LogEvent>(nullptr, LogLevel::UNKNOWN, nullptr, 0, 0, 0, 0, 0);
+            ring->spare[i] = make_shared<LogEvent>(nullptr, LogLevel::UNKNOWN, nullptr, 0, 0, 0, 0, 0);
+        }
+        return ring;
+    }
+
+    RingBufferLogAppender::Ring *RingBufferLogAppender::getRing()
+    {
+        for (auto &i : t_ringCache)
+        {
+            if (i.first == m_id)
+            {
+                return (Ring *)i.second;
+            }
+        }
+        uint32_t tid = getThreadID();
+        Ring *ring;
+        bool created = false;
+        {
+            lock_guard<mutex> lock(m_rings->mtx);
+            shared_ptr<Ring> &r = m_rings->live[tid];
+            if (!r)
+            {
+                r = newRing();
+                created = true;
+            }
+            ring = r.get();
+        }
+        if (created && !t_exitCallbacks.exited)
+        {
+            // 线程退出时把环移到exited，还有记录的留到下一次dump
+            weak_ptr<Rings> weak = m_rings;
+            uint64_t id = m_id;
+            t_exitCallbacks.cbs.push_back([weak, tid, id]()
+                                          {
+                                              for (auto &i : t_ringCache)
+                                              {
+                                                  if (i.first == id)
+                                                  {
+                                                      i = make_pair(0, nullptr);
+                                                  }
+                                              }
+                                              shared_ptr<Rings> rings = weak.lock();
+                                              if (!rings)
+                                              {
+                                                  return;
+                                              }
+                                              lock_guard<mutex> lock(rings->mtx);
+                                              auto it = rings->live.find(tid);
+                                              if (it == rings->live.end())
+                                              {
+                                                  return;
+                                              }
+                                              bool empty;
+                                              {
+                                                  lock_guard<mutex> ring_lock(it->second->mtx);
+                                                  empty = it->second->size == 0;
+                                              }
+                                              if (!empty)
+                                              {
+                                                  rings->exited.push_back(it->second);
+                                                  if (rings->exited.size() > kMaxExitedRings)
+                                                  {
+                                                      rings->exited.pop_front();
+                                                  }
+                                              }
+                                              rings->live.erase(it); });
+        }
+        if (!t_exitCallbacks.exited)
+        {
+            t_ringCache[t_ringCacheNext] = make_pair(m_id, (void *)ring);
+            t_ringCacheNext = (t_ringCacheNext + 1) % kRingCacheSize;
+        }
+        return ring;
+    }
+
+    void RingBufferLogAppender::log(Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event)
+    {
+        if (level < m_level)
+        {
+            return;
+        }
+        Ring *ring = getRing();
+        {
+            // 只有dump会和这里竞争
+            lock_guard<mutex> lock(ring->mtx);
+            LogEvent::ptr &entry = ring->entries[ring->next];
+            // 上次dump出去的事件可能还被异步的目标持有
+            if (entry.use_count() > 1)
+            {
+                entry = make_shared<LogEvent>(nullptr, LogLevel::UNKNOWN, nullptr, 0, 0, 0, 0, 0);
+            }
+            // 复用事件已有的内存，logger相同时不改引用计数
+            entry->assign(*event);
+            ring->next = (ring->next + 1) % m_capacity;
+            ring->size = min(ring->size + 1, m_capacity);
+        }
+        if (level >= m_trigger || m_dumpGen.load(memory_order_relaxed) != s_dumpGen.load(memory_order_relaxed))
+        {
+            dump();
+        }
+    }
+
+    void RingBufferLogAppender::flush()
+    {
+        if (m_dumpGen.load(memory_order_relaxed) != s_dumpGen.load(memory_order_relaxed))
+        {
+            dump();
+        }
+        m_target->flush();
+    }
+
+    void RingBufferLogAppender::dump()
+    {
+        lock_guard<mutex> dump_lock(m_dumpMutex);
+        m_dumpGen.store(s_dumpGen.load());
+        // 先把各线程的记录换出来，输出时不挡住写日志的线程；已退出线程的环在输出完之后释放
+        vector<shared_ptr<Ring>> rings;
+        {
+            lock_guard<mutex> lock(m_rings->mtx);
+            for (auto &i : m_rings->live)
+            {
+                rings.push_back(i.second);
+            }
+            rings.insert(rings.end(), m_rings->exited.begin(), m_rings->exited.end());
+            m_rings->exited.clear();
+        }
+        vector<vector<LogEvent::ptr *>> runs(rings.size());
+        for (size_t r = 0; r < rings.size(); ++r)
+        {
+            Ring *ring = rings[r].get();
+            lock_guard<mutex> ring_lock(ring->mtx);
+            size_t start = (ring->next + m_capacity - ring->size) % m_capacity;
+            for (size_t n = 0; n < ring->size; ++n)
+            {
+                // 交换后spare里的位置和entries对应，spare里也是预先分配好的事件
+                size_t pos = (start + n) % m_capacity;
+                swap(ring->entries[pos], ring->spare[pos]);
+                runs[r].push_back(&ring->spare[pos]);
+            }
+            ring->size = 0;
+        }
+        if (!m_target->hasFormatter())
         {
-            return it->second;
+            m_target->setFormatter(getFormatter());
         }
-        Logger::ptr logger(new Logger(name));
-        logger->m_root = m_root;
-        m_loggers[name] = logger;
+        // 每个线程的记录已经按写入顺序排好，按时间归并，时间相同时按环的顺序
+        typedef pair<uint64_t, size_t> Head;
+        priority_queue<Head, vector<Head>, greater<Head>> heads;
+        vector<size_t> pos(runs.size(), 0);
+        for (size_t r = 0; r < runs.size(); ++r)
+        {
+            if (!runs[r].empty())
+            {
+                heads.push(make_pair((*runs[r][0])->getTimeUS(), r));
+            }
+        }
+        while (!heads.empty())
+        {
+            size_t r = heads.top().second;
+            heads.pop();
+            LogEvent::ptr &event = *runs[r][pos[r]++];
+            m_target->log(event->getLogger(), event->getLevel(), event);
+            if (pos[r] < runs[r].size())
+            {
+                heads.push(make_pair((*runs[r][pos[r]])->getTimeUS(), r));
+            }
+        }
+        m_target->flush();
+    }
+
+    void RingBufferLogAppender::RequestDump()
+    {
+        s_dumpGen.fetch_add(1);
+    }
+
+    static void DumpSignalHandler(int)
+    {
+        RingBufferLogAppender::RequestDump();
+    }
+
+    void RingBufferLogAppender::InstallDumpSignal(int sig)
+    {
+        struct sigaction sa;
+        memset(&sa, 0, sizeof(sa));
+        sa.sa_handler = DumpSignalHandler;
+        sa.sa_flags = SA_RESTART;
+        sigemptyset(&sa.sa_mask);
+        sigaction(sig, &sa, nullptr);
+    }
+
+    LoggerManager::LoggerManager()
+    {
+        m_root.reset(new Logger);
+        m_root->addAppender(LogAppender::ptr(new StdoutLogAppender));
+        m_loggers.update([this](map<string, Logger::ptr> &loggers)
+                         { loggers[m_root->m_name] = m_root; });
+        init();
+    }
+
+    LoggerManager::~LoggerManager()
+    {
+        // 异步appender队列里的事件持有logger，退出前排空，避免循环引用导致事件丢失
+        m_loggers.read([](const map<string, Logger::ptr> &loggers)
+                       {
+                           for (auto &i : loggers)
+                           {
+                               i.second->m_appenders.read([](const vector<LogAppender::ptr> &appenders)
+                                                          {
+                                                              for (auto &appender : appenders)
+                                                              {
+                                                                  appender->flush();
+                                                              } });
+                           } });
+    }
+
+    Logger::ptr LoggerManager::getLogger(const string &name)
+    {
+        Logger::ptr logger = m_loggers.read([&name](const map<string, Logger::ptr> &loggers)
+                                            {
+                                                auto it = loggers.find(name);
+                                                return it == loggers.end() ? Logger::ptr() : it->second; });
+        if (logger)
+        {
+            return logger;
+        }
+        // 可能有别的线程同时创建，在写锁内再查一次
+        m_loggers.update([&](map<string, Logger::ptr> &loggers)
+                         {
+                             Logger::ptr &v = loggers[name];
+                             if (!v)
+                             {
+                                 v.reset(new Logger(name));
+                                 v->m_root = m_root;
+                             }
+                             logger = v; });
         return logger;
     }
-    struct LogAppendderDefine
+    struct LogAppenderDefine
     {
-        int type=0;/*1.file  2.stdout*/
-        LogLevel::Level level;
+        int type = 0; /*1.file  2.stdout*/
+        LogLevel::Level level = LogLevel::Level::UNKNOWN;
         string format;
         string file;
 
-        bool operator==(const LogAppendderDefine &other) const
+        bool operator==(const LogAppenderDefine &other) const
         {
             return type == other.type && level == other.level && format == other.format && file == other.file;
         }
@@ -447,17 +2971,238 @@ namespace jyl
         string name;
         LogLevel::Level level = LogLevel::Level::UNKNOWN;
         string format;
+        uint32_t rate_limit = 0; // 每秒最多多少条，0不限
+        uint32_t rate_burst = 0; // 允许连续输出的条数
 
         vector<LogAppenderDefine> appenders;
         bool operator==(const LogDefine &other) const
         {
             return name == other.name && level == other.level &&
-                format == other.format && appenders == other.appenders;
+                   format == other.format && rate_limit == other.rate_limit &&
+                   rate_burst == other.rate_burst && appenders == other.appenders;
+        }
+        bool operator<(const LogDefine &other) const
+        {
+            return name < other.name;
+        }
+    };
+
+    template <>
+    class FromNode<LogDefine>
+    {
+    public:
+        LogDefine operator()(const YAML::Node &node)
+        {
+            LogDefine ld;
+            if (!node["name"].IsDefined())
+            {
+                std::cout << "log config error: name is null, " << node << std::endl;
+                throw logic_error("log config name is null");
+            }
+            ld.name = node["name"].as<string>();
+            ld.level = LogLevel::FromString(node["level"].IsDefined() ? node["level"].as<string>() : "");
+            if (node["formatter"].IsDefined())
+            {
+                ld.format = node["formatter"].as<string>();
+            }
+            if (node["rate_limit"].IsDefined())
+            {
+                ld.rate_limit = node["rate_limit"].as<uint32_t>();
+            }
+            if (node["rate_burst"].IsDefined())
+            {
+                ld.rate_burst = node["rate_burst"].as<uint32_t>();
+            }
+            if (node["appender"].IsDefined())
+            {
+                for (size_t i = 0; i < node["appender"].size(); ++i)
+                {
+                    auto a = node["appender"][i];
+                    if (!a["type"].IsDefined())
+                    {
+                        std::cout << "log config error: appender type is null, " << a << std::endl;
+                        continue;
+                    }
+                    string type = a["type"].as<string>();
+                    LogAppenderDefine lad;
+                    if (type == "FileLogAppender")
+                    {
+                        lad.type = 1;
+                        if (!a["file"].IsDefined())
+                        {
+                            std::cout << "log config error: fileappender file is null, " << a << std::endl;
+                            continue;
+                        }
+                        lad.file = a["file"].as<string>();
+                    }
+                    else if (type == "StdoutLogAppender")
+                    {
+                        lad.type = 2;
+                    }
+                    else
+                    {
+                        std::cout << "log config error: appender type is invalid, " << a << std::endl;
+                        continue;
+                    }
+                    if (a["level"].IsDefined())
+                    {
+                        lad.level = LogLevel::FromString(a["level"].as<string>());
+                    }
+                    if (a["formatter"].IsDefined())
+                    {
+                        lad.format = a["formatter"].as<string>();
+                    }
+                    ld.appenders.push_back(lad);
+                }
+            }
+            return ld;
+        }
+    };
+
+    template <>
+    class ToNode<LogDefine>
+    {
+    public:
+        YAML::Node operator()(const LogDefine &ld)
+        {
+            YAML::Node node;
+            node["name"] = ld.name;
+            if (ld.level != LogLevel::UNKNOWN)
+            {
+                node["level"] = LogLevel::toString(ld.level);
+            }
+            if (!ld.format.empty())
+            {
+                node["formatter"] = ld.format;
+            }
+            if (ld.rate_limit)
+            {
+                node["rate_limit"] = ld.rate_limit;
+                node["rate_burst"] = ld.rate_burst;
+            }
+            for (auto &a : ld.appenders)
+            {
+                YAML::Node na;
+                if (a.type == 1)
+                {
+                    na["type"] = "FileLogAppender";
+                    na["file"] = a.file;
+                }
+                else if (a.type == 2)
+                {
+                    na["type"] = "StdoutLogAppender";
+                }
+                if (a.level != LogLevel::UNKNOWN)
+                {
+                    na["level"] = LogLevel::toString(a.level);
+                }
+                if (!a.format.empty())
+                {
+                    na["formatter"] = a.format;
+                }
+                node["appender"].push_back(na);
+            }
+            return node;
+        }
+    };
+
+    static ConfigVar<set<LogDefine>>::ptr g_log_defines =
+        Config::Lookup("logs", set<LogDefine>(), "logs config");
+
+    // formatter写成json时用JsonLogFormatter
+    static LogFormatter::ptr MakeFormatter(const string &pattern)
+    {
+        if (pattern == "json")
+        {
+            return LogFormatter::ptr(new JsonLogFormatter);
+        }
+        return LogFormatter::ptr(new LogFormatter(pattern));
+    }
+
+    // 把配置应用到logger上
+    static void ApplyLogDefine(const LogDefine &ld)
+    {
+        Logger::ptr logger = JYL_LOG_NAME(ld.name);
+        logger->setLevel(ld.level);
+        if (!ld.format.empty())
+        {
+            LogFormatter::ptr fmt = MakeFormatter(ld.format);
+            if (!fmt->isError())
+            {
+                logger->setFormatter(fmt);
+            }
+            else
+            {
+                std::cout << "log name=" << ld.name << " formatter=" << ld.format << " is invalid" << std::endl;
+            }
+        }
+        logger->setRateLimit(ld.rate_limit, ld.rate_burst);
+        logger->clearAppenders();
+        for (auto &a : ld.appenders)
+        {
+            LogAppender::ptr ap;
+            if (a.type == 1)
+            {
+                ap.reset(new FileLogAppender(a.file));
+            }
+            else if (a.type == 2)
+            {
+                ap.reset(new StdoutLogAppender);
+            }
+            if (a.level != LogLevel::UNKNOWN)
+            {
+                ap->setLevel(a.level);
+            }
+            if (!a.format.empty())
+            {
+                LogFormatter::ptr fmt = MakeFormatter(a.format);
+                if (!fmt->isError())
+                {
+                    ap->setFormatter(fmt);
+                }
+                else
+                {
+                    std::cout << "log name=" << ld.name << " appender type=" << a.type
+                              << " formatter=" << a.format << " is invalid" << std::endl;
+                }
+            }
+            logger->addAppender(ap);
+        }
+    }
+
+    struct LogIniter
+    {
+        LogIniter()
+        {
+            g_log_defines->addListener(0xF1E231, [](const set<LogDefine> &old_value, const set<LogDefine> &new_value)
+                                       {
+                                           // 新增和修改的logger
+                                           for (auto &i : new_value)
+                                           {
+                                               auto it = old_value.find(i);
+                                               if (it == old_value.end() || !(i == *it))
+                                               {
+                                                   ApplyLogDefine(i);
+                                               }
+                                           }
+                                           // 删除的logger关掉
+                                           for (auto &i : old_value)
+                                           {
+                                               if (new_value.find(i) == new_value.end())
+                                               {
+                                                   Logger::ptr logger = JYL_LOG_NAME(i.name);
+                                                   logger->setLevel(LogLevel::OFF);
+                                                   logger->setRateLimit(0, 0);
+                                                   logger->clearAppenders();
+                                               }
+                                           } });
         }
     };
 
+    static LogIniter __log_init;
+
     void LoggerManager::init()
     {
 
     }
-}
\ No newline at end of file
+}
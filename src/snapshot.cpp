@@ -0,0 +1,106 @@
+#include "../include/snapshot.h"
+
+namespace jyl
+{
+    namespace detail
+    {
+        static const int kHazardSlots = 8; // 每个线程最多同时读几个快照
+
+        // 线程退出后记录留给新线程复用，不释放
+        struct HazardRecord
+        {
+            atomic<const void *> slots[kHazardSlots];
+            uint32_t used_slots = 0; // 第i位表示slots[i]在用，Ref可以不按顺序释放
+            atomic<bool> used{true};
+            HazardRecord *next = nullptr;
+        };
+
+        static atomic<HazardRecord *> s_records{nullptr};
+
+        static HazardRecord *AcquireRecord()
+        {
+            for (HazardRecord *rec = s_records.load(); rec; rec = rec->next)
+            {
+                bool used = false;
+                if (!rec->used.load(memory_order_relaxed) && rec->used.compare_exchange_strong(used, true))
+                {
+                    return rec;
+                }
+            }
+            HazardRecord *rec = new HazardRecord;
+            for (auto &i : rec->slots)
+            {
+                i.store(nullptr, memory_order_relaxed);
+            }
+            rec->next = s_records.load();
+            while (!s_records.compare_exchange_weak(rec->next, rec))
+            {
+            }
+            return rec;
+        }
+
+        static thread_local HazardRecord *t_record = nullptr;
+        static thread_local bool t_exited = false;
+
+        // 线程退出时归还记录
+        struct HazardRecordHolder
+        {
+            ~HazardRecordHolder()
+            {
+                if (t_record)
+                {
+                    t_record->used_slots = 0;
+                    t_record->used.store(false);
+                    t_record = nullptr;
+                }
+                t_exited = true;
+            }
+        };
+        static thread_local HazardRecordHolder t_holder;
+
+        HazardGuard::HazardGuard() : m_slot(nullptr)
+        {
+            if (!t_record)
+            {
+                if (t_exited)
+                {
+                    return;
+                }
+                t_record = AcquireRecord();
+                (void)t_holder;
+            }
+            uint32_t free_slots = ~t_record->used_slots & ((1u << kHazardSlots) - 1);
+            if (free_slots)
+            {
+                int i = __builtin_ctz(free_slots);
+                t_record->used_slots |= 1u << i;
+                m_slot = &t_record->slots[i];
+            }
+        }
+
+        HazardGuard::~HazardGuard()
+        {
+            // 线程退出时记录已经归还，槽也已清空
+            if (m_slot && t_record)
+            {
+                m_slot->store(nullptr, memory_order_release);
+                t_record->used_slots &= ~(1u << (m_slot - t_record->slots));
+            }
+        }
+
+        bool IsHazard(const void *p)
+        {
+            for (HazardRecord *rec = s_records.load(); rec; rec = rec->next)
+            {
+                for (auto &i : rec->slots)
+                {
+                    if (i.load() == p)
+                    {
+                        return true;
+                    }
+                }
+            }
+            return false;
+        }
+    }
+}
@@ -1,8 +1,165 @@
 #include "../include/util.h"
+#include <string.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <x86intrin.h>
+#endif
 
 namespace jyl
 {
-    pid_t getThreadID() { return syscall(SYS_gettid); }
+    static thread_local pid_t t_threadID = 0;
+    // 内核限制线程名16字节(含'\0')
+    static thread_local char t_threadName[16] = {0};
+
+    // fork出来的子进程里只有调用fork的线程，tid变了
+    static void ResetThreadIDAfterFork()
+    {
+        t_threadID = 0;
+    }
+
+    pid_t getThreadID()
+    {
+        if (__builtin_expect(t_threadID == 0, 0))
+        {
+            static int s_atfork = pthread_atfork(nullptr, nullptr, ResetThreadIDAfterFork);
+            (void)s_atfork;
+            t_threadID = syscall(SYS_gettid);
+        }
+        return t_threadID;
+    }
 
     uint32_t getFiberID() { return 0; }
-}
\ No newline at end of file
+
+    uint64_t getRealTimeUS()
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        return ts.tv_sec * 1000000ull + ts.tv_nsec / 1000;
+    }
+
+    static uint64_t MonotonicNS(clockid_t clock)
+    {
+        struct timespec ts;
+        clock_gettime(clock, &ts);
+        return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+    }
+
+    uint64_t getCurrentMS()
+    {
+        // 老内核没有CLOCK_MONOTONIC_COARSE
+        static const clockid_t s_clock = []()
+        {
+            struct timespec ts;
+            return clock_getres(CLOCK_MONOTONIC_COARSE, &ts) == 0 ? CLOCK_MONOTONIC_COARSE : CLOCK_MONOTONIC;
+        }();
+        return MonotonicNS(s_clock) / 1000000;
+    }
+
+    uint64_t getCurrentUS()
+    {
+        return MonotonicNS(CLOCK_MONOTONIC) / 1000;
+    }
+
+    uint32_t getElapsedMS()
+    {
+        static const uint64_t s_start = getCurrentMS();
+        return getCurrentMS() - s_start;
+    }
+    // 静态初始化时就记下起点，不等到第一条日志
+    static uint32_t s_elapsedInit = getElapsedMS();
+
+    // invariant TSC：频率不随降频和休眠变化，各核之间同步
+    static bool HasInvariantTSC()
+    {
+#if defined(__x86_64__) || defined(__i386__)
+        unsigned int eax, ebx, ecx, edx;
+        if (__get_cpuid(0x80000000, &eax, &ebx, &ecx, &edx) == 0 || eax < 0x80000007)
+        {
+            return false;
+        }
+        __get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx);
+        return edx & (1 << 8);
+#else
+        return false;
+#endif
+    }
+
+    uint64_t CycleClock::Now()
+    {
+#if defined(__x86_64__) || defined(__i386__)
+        if (IsTSC())
+        {
+            return __rdtsc();
+        }
+#endif
+        return MonotonicNS(CLOCK_MONOTONIC);
+    }
+
+    double CycleClock::Frequency()
+    {
+        static const double s_frequency = []()
+        {
+            if (!IsTSC())
+            {
+                return 1e9;
+            }
+            uint64_t ns0 = MonotonicNS(CLOCK_MONOTONIC);
+            uint64_t c0 = Now();
+            usleep(10000);
+            uint64_t ns1 = MonotonicNS(CLOCK_MONOTONIC);
+            uint64_t c1 = Now();
+            return (c1 - c0) * 1e9 / (ns1 - ns0);
+        }();
+        return s_frequency;
+    }
+
+    bool CycleClock::IsTSC()
+    {
+        static const bool s_tsc = HasInvariantTSC();
+        return s_tsc;
+    }
+
+    Thread::Thread(function<void()> cb, const string &name)
+        : m_name(name)
+    {
+        m_thread = thread([cb, name]()
+                          {
+                              Thread::SetName(name);
+                              cb(); });
+    }
+
+    Thread::~Thread()
+    {
+        if (m_thread.joinable())
+        {
+            m_thread.detach();
+        }
+    }
+
+    void Thread::join()
+    {
+        if (m_thread.joinable())
+        {
+            m_thread.join();
+        }
+    }
+
+    const char *Thread::GetName()
+    {
+        if (__builtin_expect(t_threadName[0] == '\0', 0))
+        {
+            if (pthread_getname_np(pthread_self(), t_threadName, sizeof(t_threadName)) != 0 || t_threadName[0] == '\0')
+            {
+                strcpy(t_threadName, "UNKNOWN");
+            }
+        }
+        return t_threadName;
+    }
+
+    void Thread::SetName(const string &name)
+    {
+        strncpy(t_threadName, name.c_str(), sizeof(t_threadName) - 1);
+        t_threadName[sizeof(t_threadName) - 1] = '\0';
+        pthread_setname_np(pthread_self(), t_threadName);
+    }
+}
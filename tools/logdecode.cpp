@@ -0,0 +1,248 @@
+#include "../include/binlog.h"
+#include <stdio.h>
+#include <unistd.h>
+
+using namespace std;
+
+/*
+    jyl-logdecode: 把BinaryLogAppender写的二进制日志还原成文本
+    用法: jyl-logdecode [-p pattern] file...
+    pattern和LogFormatter一样，默认是Logger的默认格式
+*/
+
+namespace
+{
+    struct Site
+    {
+        jyl::LogLevel::Level level;
+        int32_t line = 0;
+        string file;
+        string fmt;
+        string types;
+    };
+
+    class Reader
+    {
+    public:
+        Reader(const char *data, size_t len) : m_p(data), m_end(data + len) {}
+        template <class T>
+        bool read(T &v)
+        {
+            if ((size_t)(m_end - m_p) < sizeof(T))
+            {
+                return false;
+            }
+            memcpy(&v, m_p, sizeof(T));
+            m_p += sizeof(T);
+            return true;
+        }
+        template <class L>
+        bool readString(string &v)
+        {
+            const char *data;
+            size_t len;
+            if (!readBytes<L>(data, len))
+            {
+                return false;
+            }
+            v.assign(data, len);
+            return true;
+        }
+        template <class L>
+        bool readBytes(const char *&data, size_t &len)
+        {
+            L n;
+            if (!read(n) || (size_t)(m_end - m_p) < n)
+            {
+                return false;
+            }
+            data = m_p;
+            len = n;
+            m_p += n;
+            return true;
+        }
+        bool eof() const { return m_p == m_end; }
+        size_t offset(const char *begin) const { return m_p - begin; }
+
+    private:
+        const char *m_p;
+        const char *m_end;
+    };
+
+    bool ReadFile(const char *name, string &data)
+    {
+        FILE *fp = fopen(name, "rb");
+        if (!fp)
+        {
+            return false;
+        }
+        char buf[64 * 1024];
+        size_t n;
+        while ((n = fread(buf, 1, sizeof(buf), fp)) > 0)
+        {
+            data.append(buf, n);
+        }
+        fclose(fp);
+        return true;
+    }
+
+    bool Decode(const char *name, jyl::LogFormatter &formatter)
+    {
+        string data;
+        if (!ReadFile(name, data))
+        {
+            fprintf(stderr, "open %s failed: %s\n", name, strerror(errno));
+            return false;
+        }
+        Reader reader(data.data(), data.size());
+        char magic[sizeof(jyl::BinaryLogAppender::kMagic)];
+        uint32_t version = 0;
+        if (!reader.read(magic) || memcmp(magic, jyl::BinaryLogAppender::kMagic, sizeof(magic)) != 0 ||
+            !reader.read(version) || version < 1 || version > jyl::BinaryLogAppender::kVersion)
+        {
+            fprintf(stderr, "%s: not a binary log file\n", name);
+            return false;
+        }
+
+        map<uint32_t, Site> sites;
+        map<uint32_t, jyl::Logger::ptr> loggers;
+        jyl::Logger::ptr unknown(new jyl::Logger("unknown"));
+        auto get_logger = [&](uint32_t id)
+        {
+            auto it = loggers.find(id);
+            return it == loggers.end() ? unknown : it->second;
+        };
+        string out;
+        while (!reader.eof())
+        {
+            uint8_t type = 0;
+            bool ok = reader.read(type);
+            if (ok && type == jyl::BinaryLogAppender::RECORD_SITE)
+            {
+                uint32_t id = 0;
+                uint8_t level = 0;
+                Site site;
+                ok = reader.read(id) && reader.read(level) && reader.read(site.line) &&
+                     reader.readString<uint16_t>(site.file) && reader.readString<uint16_t>(site.fmt) &&
+                     reader.readString<uint16_t>(site.types);
+                site.level = (jyl::LogLevel::Level)level;
+                if (ok)
+                {
+                    sites[id] = site;
+                }
+                continue;
+            }
+            else if (ok && type == jyl::BinaryLogAppender::RECORD_LOGGER)
+            {
+                uint32_t id = 0;
+                string logger_name;
+                ok = reader.read(id) && reader.readString<uint16_t>(logger_name);
+                if (ok)
+                {
+                    loggers[id] = jyl::Logger::ptr(new jyl::Logger(logger_name));
+                }
+                continue;
+            }
+
+            out.clear();
+            if (ok && type == jyl::BinaryLogAppender::RECORD_EVENT)
+            {
+                uint32_t site_id = 0, logger_id = 0, elapse = 0, thread_id = 0, fiber_id = 0;
+                uint64_t time_us = 0;
+                const char *args;
+                size_t len;
+                ok = reader.read(site_id) && reader.read(logger_id) && reader.read(time_us) &&
+                     (version < 2 || reader.read(elapse)) && reader.read(thread_id) && reader.read(fiber_id) &&
+                     reader.readBytes<uint32_t>(args, len);
+                auto it = sites.find(site_id);
+                if (ok && it != sites.end())
+                {
+                    const Site &site = it->second;
+                    jyl::Logger::ptr logger = get_logger(logger_id);
+                    jyl::LogEvent event(logger, site.level, site.file.c_str(), site.line, elapse, thread_id, fiber_id, time_us);
+                    // 文件里没有记录线程名
+                    event.setThreadName("");
+                    if (!jyl::detail::BinDecode(event.getSS(), site.fmt.c_str(), site.types.c_str(), args, len))
+                    {
+                        event.getSS() << " <<bad arguments>>";
+                    }
+                    formatter.format(out, logger.get(), site.level, event);
+                }
+                else if (ok)
+                {
+                    fprintf(stderr, "%s: unknown site %u\n", name, site_id);
+                }
+            }
+            else if (ok && type == jyl::BinaryLogAppender::RECORD_TEXT)
+            {
+                uint32_t logger_id = 0, elapse = 0, thread_id = 0, fiber_id = 0;
+                uint8_t level = 0;
+                uint64_t time_us = 0;
+                int32_t line = 0;
+                string file;
+                const char *content;
+                size_t len;
+                ok = reader.read(logger_id) && reader.read(level) && reader.read(time_us) &&
+                     (version < 2 || reader.read(elapse)) && reader.read(thread_id) && reader.read(fiber_id) && reader.read(line) &&
+                     reader.readString<uint16_t>(file) && reader.readBytes<uint32_t>(content, len);
+                if (ok)
+                {
+                    jyl::Logger::ptr logger = get_logger(logger_id);
+                    jyl::LogEvent event(logger, (jyl::LogLevel::Level)level, file.c_str(), line, elapse, thread_id, fiber_id, time_us);
+                    event.setThreadName("");
+                    event.getSS().append(content, len);
+                    formatter.format(out, logger.get(), (jyl::LogLevel::Level)level, event);
+                }
+            }
+            else
+            {
+                ok = false;
+            }
+            if (!ok)
+            {
+                fprintf(stderr, "%s: corrupted record at offset %zu\n", name, reader.offset(data.data()));
+                return false;
+            }
+            if (!out.empty())
+            {
+                // 和FileLogAppender的输出保持一致
+                out.append(1, '\n');
+                fwrite(out.data(), 1, out.size(), stdout);
+            }
+        }
+        return true;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    string pattern = "%d{%Y-%m-%d %H:%M:%S}%T%t%T%F%T[%p]%T%f:%l%T%m%n";
+    int opt;
+    while ((opt = getopt(argc, argv, "p:h")) != -1)
+    {
+        if (opt == 'p')
+        {
+            pattern = optarg;
+        }
+        else
+        {
+            fprintf(stderr, "usage: %s [-p pattern] file...\n", argv[0]);
+            return 1;
+        }
+    }
+    if (optind >= argc)
+    {
+        fprintf(stderr, "usage: %s [-p pattern] file...\n", argv[0]);
+        return 1;
+    }
+    jyl::LogFormatter formatter(pattern);
+    int rt = 0;
+    for (int i = optind; i < argc; ++i)
+    {
+        if (!Decode(argv[i], formatter))
+        {
+            rt = 1;
+        }
+    }
+    return rt;
+}
@@ -0,0 +1,315 @@
+#include "../include/log.h"
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/stat.h>
+
+using namespace std;
+
+/*
+    jyl-logq: 用FileLogAppender写的索引(文件名.idx)在大日志文件里按时间和级别查找
+    用法: jyl-logq [-f 开始时间] [-t 结束时间] [-l 最低级别] [-g 字符串] [-s] file...
+    时间写成"2024-01-02 15:04:05"、"2024-01-02"(本地时间)或者秒级时间戳。
+    索引只能定位到块，时间范围按块筛选，输出的是这些块里的行；
+    -l时只输出含有该级别及以上级别名称的行，-g只输出包含该字符串的行。
+    没有索引的文件、索引没有覆盖到的部分整体读一遍。-s在标准错误里输出读了多少块和耗时
+*/
+
+namespace
+{
+    struct Query
+    {
+        uint64_t from = 0;
+        uint64_t to = UINT64_MAX;
+        jyl::LogLevel::Level level = jyl::LogLevel::UNKNOWN;
+        uint32_t levels = jyl::LogIndexEntry::kAllLevels; // 要找的级别，第level位
+        string grep;
+        bool stats = false;
+    };
+
+    // 解析失败返回false，end为true时返回这一秒(只有日期时是这一天)的最后一微秒
+    bool ParseTime(const char *str, uint64_t &us, bool end)
+    {
+        char *p_end;
+        unsigned long long sec = strtoull(str, &p_end, 10);
+        if (*str && !*p_end)
+        {
+            us = sec * 1000000 + (end ? 999999 : 0);
+            return true;
+        }
+        uint64_t span = 1;
+        struct tm tm;
+        memset(&tm, 0, sizeof(tm));
+        const char *p = strptime(str, "%Y-%m-%d %H:%M:%S", &tm);
+        if (!p || *p)
+        {
+            memset(&tm, 0, sizeof(tm));
+            p = strptime(str, "%Y-%m-%d", &tm);
+            span = 86400;
+        }
+        if (!p || *p)
+        {
+            return false;
+        }
+        tm.tm_isdst = -1;
+        us = (uint64_t)mktime(&tm) * 1000000 + (end ? span * 1000000 - 1 : 0);
+        return true;
+    }
+
+    // 读索引，没有或者格式不对返回空
+    vector<jyl::LogIndexEntry> ReadIndex(const string &name, uint64_t file_size)
+    {
+        vector<jyl::LogIndexEntry> entries;
+        int fd = open(name.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+        {
+            return entries;
+        }
+        struct stat st;
+        char magic[sizeof(jyl::FileLogAppender::kIndexMagic)];
+        uint32_t version = 0;
+        const size_t header = sizeof(magic) + sizeof(version);
+        if (fstat(fd, &st) == 0 && (size_t)st.st_size >= header &&
+            pread(fd, magic, sizeof(magic), 0) == sizeof(magic) &&
+            memcmp(magic, jyl::FileLogAppender::kIndexMagic, sizeof(magic)) == 0 &&
+            pread(fd, &version, sizeof(version), sizeof(magic)) == sizeof(version) &&
+            version == jyl::FileLogAppender::kIndexVersion)
+        {
+            entries.resize((st.st_size - header) / sizeof(jyl::LogIndexEntry));
+            size_t len = entries.size() * sizeof(jyl::LogIndexEntry);
+            if (pread(fd, entries.data(), len, header) != (ssize_t)len)
+            {
+                entries.clear();
+            }
+        }
+        close(fd);
+        // 日志文件被截断过，索引不可信
+        if (!entries.empty() && entries.back().offset + entries.back().length > file_size)
+        {
+            fprintf(stderr, "%s: index does not match the log file, ignored\n", name.c_str());
+            entries.clear();
+        }
+        return entries;
+    }
+
+    class LineFilter
+    {
+    public:
+        LineFilter(const Query &query) : m_query(query)
+        {
+            for (int i = query.level; query.level != jyl::LogLevel::UNKNOWN && i <= jyl::LogLevel::FATAL; ++i)
+            {
+                m_levelNames.push_back(jyl::LogLevel::toString((jyl::LogLevel::Level)i));
+            }
+        }
+
+        // 处理一段内容，最后不完整的行留到下一段
+        void feed(const char *data, size_t len)
+        {
+            const char *end = data + len;
+            while (data < end)
+            {
+                const char *nl = (const char *)memchr(data, '\n', end - data);
+                if (!nl)
+                {
+                    m_carry.append(data, end - data);
+                    return;
+                }
+                if (m_carry.empty())
+                {
+                    line(data, nl - data + 1);
+                }
+                else
+                {
+                    m_carry.append(data, nl - data + 1);
+                    line(m_carry.data(), m_carry.size());
+                    m_carry.clear();
+                }
+                data = nl + 1;
+            }
+        }
+        void finish()
+        {
+            if (!m_carry.empty())
+            {
+                m_carry.append(1, '\n');
+                line(m_carry.data(), m_carry.size());
+                m_carry.clear();
+            }
+        }
+
+    private:
+        static bool Contains(const char *data, size_t len, const char *s, size_t n)
+        {
+            return n == 0 || memmem(data, len, s, n) != nullptr;
+        }
+        void line(const char *data, size_t len)
+        {
+            if (!m_levelNames.empty())
+            {
+                bool found = false;
+                for (auto name : m_levelNames)
+                {
+                    if (Contains(data, len, name, strlen(name)))
+                    {
+                        found = true;
+                        break;
+                    }
+                }
+                if (!found)
+                {
+                    return;
+                }
+            }
+            if (!Contains(data, len, m_query.grep.data(), m_query.grep.size()))
+            {
+                return;
+            }
+            fwrite(data, 1, len, stdout);
+        }
+
+    private:
+        const Query &m_query;
+        vector<const char *> m_levelNames;
+        string m_carry;
+    };
+
+    bool Search(const char *name, const Query &query)
+    {
+        uint64_t begin = jyl::getCurrentUS();
+        int fd = open(name, O_RDONLY | O_CLOEXEC);
+        struct stat st;
+        if (fd < 0 || fstat(fd, &st) != 0)
+        {
+            fprintf(stderr, "open %s failed: %s\n", name, strerror(errno));
+            if (fd >= 0)
+            {
+                close(fd);
+            }
+            return false;
+        }
+        uint64_t file_size = st.st_size;
+        vector<jyl::LogIndexEntry> entries = ReadIndex(string(name) + ".idx", file_size);
+
+        // 挑出要读的范围，相邻的合并
+        vector<pair<uint64_t, uint64_t>> ranges;
+        auto add = [&ranges](uint64_t offset, uint64_t len)
+        {
+            if (!ranges.empty() && ranges.back().first + ranges.back().second == offset)
+            {
+                ranges.back().second += len;
+            }
+            else
+            {
+                ranges.push_back(make_pair(offset, len));
+            }
+        };
+        size_t selected = 0;
+        for (auto &i : entries)
+        {
+            if (i.maxTime >= query.from && i.minTime <= query.to && (i.levels & query.levels))
+            {
+                add(i.offset, i.length);
+                ++selected;
+            }
+        }
+        uint64_t indexed = entries.empty() ? 0 : entries.back().offset + entries.back().length;
+        if (indexed < file_size)
+        {
+            add(indexed, file_size - indexed);
+        }
+
+        LineFilter filter(query);
+        vector<char> buf(1024 * 1024);
+        uint64_t bytes = 0;
+        for (auto &r : ranges)
+        {
+            uint64_t offset = r.first;
+            uint64_t end = r.first + r.second;
+            while (offset < end)
+            {
+                ssize_t n = pread(fd, buf.data(), min<uint64_t>(buf.size(), end - offset), offset);
+                if (n <= 0)
+                {
+                    break;
+                }
+                filter.feed(buf.data(), n);
+                offset += n;
+                bytes += n;
+            }
+            filter.finish();
+        }
+        close(fd);
+        if (query.stats)
+        {
+            fprintf(stderr, "%s: %zu/%zu blocks, %llu unindexed bytes, read %llu of %llu bytes in %.3f ms\n",
+                    name, selected, entries.size(), (unsigned long long)(file_size - indexed),
+                    (unsigned long long)bytes, (unsigned long long)file_size, (jyl::getCurrentUS() - begin) / 1000.0);
+        }
+        return true;
+    }
+
+    void Usage(const char *prog)
+    {
+        fprintf(stderr, "usage: %s [-f from] [-t to] [-l level] [-g string] [-s] file...\n"
+                        "  time: \"YYYY-mm-dd HH:MM:SS\", \"YYYY-mm-dd\" or unix seconds\n",
+                prog);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    Query query;
+    int opt;
+    while ((opt = getopt(argc, argv, "f:t:l:g:sh")) != -1)
+    {
+        switch (opt)
+        {
+        case 'f':
+        case 't':
+            if (!ParseTime(optarg, opt == 'f' ? query.from : query.to, opt == 't'))
+            {
+                fprintf(stderr, "invalid time: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'l':
+            query.level = jyl::LogLevel::FromString(optarg);
+            if (query.level == jyl::LogLevel::UNKNOWN || query.level > jyl::LogLevel::FATAL)
+            {
+                fprintf(stderr, "invalid level: %s\n", optarg);
+                return 1;
+            }
+            query.levels = 0;
+            for (int i = query.level; i <= jyl::LogLevel::FATAL; ++i)
+            {
+                query.levels |= 1u << i;
+            }
+            break;
+        case 'g':
+            query.grep = optarg;
+            break;
+        case 's':
+            query.stats = true;
+            break;
+        default:
+            Usage(argv[0]);
+            return 1;
+        }
+    }
+    if (optind >= argc)
+    {
+        Usage(argv[0]);
+        return 1;
+    }
+    int rt = 0;
+    for (int i = optind; i < argc; ++i)
+    {
+        if (!Search(argv[i], query))
+        {
+            rt = 1;
+        }
+    }
+    return rt;
+}